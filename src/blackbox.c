@@ -0,0 +1,169 @@
+#include "board.h"
+#include "mw.h"
+
+// Blackbox flight recorder
+// While armed, every blackbox_rate_div'th loop is encoded and queued on the serial port for an external logger.
+// A frame is a marker byte followed by each field as a zigzag varint. 'I' frames hold absolute values,
+// 'P' frames the difference to the previous frame, which is mostly one byte per field.
+// An 'I' frame is sent every BLACKBOX_I_INTERVAL frames and after any frame that didn't fit into txBuffer,
+// so a dropped frame never corrupts the ones after it.
+//
+// Header at arming: 'H' BLACKBOX_VERSION fieldCount motorCount rateDiv
+// Fields: iteration, time (us), cycleTime, flags, gyroData[3], accSmooth[3], rcCommand[4],
+//         axisP[3], axisI[3], axisD[3], motor[motorCount]
+// End at disarming: 'E'
+
+#define BLACKBOX_VERSION        1
+#define BLACKBOX_I_INTERVAL     32
+#define BLACKBOX_BASE_FIELDS    23
+#define BLACKBOX_MAX_FIELDS     (BLACKBOX_BASE_FIELDS + MAX_MOTORS)
+#define BLACKBOX_MAX_FRAME      (1 + BLACKBOX_MAX_FIELDS * 5)   // a 32bit varint is at most 5 bytes
+
+typedef enum {
+    BLACKBOX_IDLE = 0,
+    BLACKBOX_HEADER,                    // armed, header not sent yet
+    BLACKBOX_LOGGING
+} blackboxState_e;
+
+// from mixer.c
+extern uint8_t numberMotor;
+
+static uint8_t blackboxState = BLACKBOX_IDLE;
+static uint8_t fieldCount;
+static int32_t previous[BLACKBOX_MAX_FIELDS];
+static uint32_t iteration;
+static uint8_t framesSinceI;
+static uint32_t cyclesAvgX16 = 0, cyclesMax = 0;
+static uint32_t framesWritten = 0, framesDropped = 0;
+
+static uint8_t *writeUnsignedVB(uint8_t *p, uint32_t value)
+{
+    while (value >= 0x80) {
+        *p++ = value | 0x80;
+        value >>= 7;
+    }
+    *p++ = value;
+    return p;
+}
+
+static uint8_t *writeSignedVB(uint8_t *p, int32_t value)
+{
+    // zigzag, so small negative numbers stay small
+    return writeUnsignedVB(p, (uint32_t)((value << 1) ^ (value >> 31)));
+}
+
+static uint8_t collectFields(int32_t *field)
+{
+    uint8_t i, n = 0;
+
+    field[n++] = iteration;
+    field[n++] = currentTime;
+    field[n++] = cycleTime;
+    field[n++] = armed | accMode << 1 | baroMode << 2 | magMode << 3 | GPSModeHome << 4 | GPSModeHold << 5;
+    for (i = 0; i < 3; i++)
+        field[n++] = gyroData[i];
+    for (i = 0; i < 3; i++)
+        field[n++] = accSmooth[i];
+    for (i = 0; i < 4; i++)
+        field[n++] = rcCommand[i];
+    for (i = 0; i < 3; i++)
+        field[n++] = axisP[i];
+    for (i = 0; i < 3; i++)
+        field[n++] = axisI[i];
+    for (i = 0; i < 3; i++)
+        field[n++] = axisD[i];
+    for (i = 0; i < numberMotor; i++)
+        field[n++] = motor[i];
+
+    return n;
+}
+
+static void blackboxStart(void)
+{
+    iteration = 0;
+    framesSinceI = BLACKBOX_I_INTERVAL;
+    fieldCount = BLACKBOX_BASE_FIELDS + numberMotor;
+    blackboxState = BLACKBOX_HEADER;
+}
+
+static void blackboxWriteHeader(void)
+{
+    uint8_t header[5];
+
+    header[0] = 'H';
+    header[1] = BLACKBOX_VERSION;
+    header[2] = fieldCount;
+    header[3] = numberMotor;
+    header[4] = cfg.blackbox_rate_div;
+    if (uartWriteIfRoom(header, sizeof(header)))
+        blackboxState = BLACKBOX_LOGGING;
+}
+
+static void blackboxWriteFrame(void)
+{
+    uint8_t frame[BLACKBOX_MAX_FRAME];
+    int32_t field[BLACKBOX_MAX_FIELDS];
+    uint8_t *p = frame;
+    uint8_t i;
+    bool keyframe = framesSinceI >= BLACKBOX_I_INTERVAL;
+
+    collectFields(field);
+
+    *p++ = keyframe ? 'I' : 'P';
+    for (i = 0; i < fieldCount; i++) {
+        p = writeSignedVB(p, keyframe ? field[i] : field[i] - previous[i]);
+        previous[i] = field[i];
+    }
+
+    if (uartWriteIfRoom(frame, p - frame)) {
+        framesWritten++;
+        framesSinceI = keyframe ? 1 : framesSinceI + 1;
+    } else {
+        // the decoder's previous values are now stale, restart the chain
+        framesDropped++;
+        framesSinceI = BLACKBOX_I_INTERVAL;
+    }
+}
+
+// called once per loop after the motors were written. A frame is a fixed number of fields,
+// so the cost per call is bounded and is measured below for 'status'.
+void blackboxUpdate(void)
+{
+    uint32_t cycles = cycleCount();
+
+    if (!armed) {
+        // the session only ends once the end marker is queued, with a full buffer try again next loop
+        if (blackboxState != BLACKBOX_IDLE && uartTxFree()) {
+            uartWrite('E');
+            blackboxState = BLACKBOX_IDLE;
+        }
+        return;
+    }
+
+    if (blackboxState == BLACKBOX_IDLE)
+        blackboxStart();
+    if (blackboxState == BLACKBOX_HEADER)
+        blackboxWriteHeader();
+    if (blackboxState == BLACKBOX_LOGGING && iteration % cfg.blackbox_rate_div == 0)
+        blackboxWriteFrame();
+    iteration++;
+
+    cycles = cycleCount() - cycles;
+    cyclesAvgX16 += cycles - (cyclesAvgX16 >> 4);
+    if (cycles > cyclesMax)
+        cyclesMax = cycles;
+}
+
+// serial port belongs to the logger while this is true
+bool blackboxIsLogging(void)
+{
+    return blackboxState != BLACKBOX_IDLE;
+}
+
+void blackboxGetStats(uint32_t *written, uint32_t *dropped, uint32_t *avgCycles, uint32_t *maxCycles)
+{
+    *written = framesWritten;
+    *dropped = framesDropped;
+    *avgCycles = cyclesAvgX16 >> 4;
+    *maxCycles = cyclesMax;
+}
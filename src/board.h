@@ -18,6 +18,17 @@
 #define M_PI       3.14159265358979323846
 #endif /* M_PI */
 
+// RC channels handled by the receiver drivers, channel map and aux switches (4 sticks + aux). 8 to 16.
+#ifndef RC_CHANS
+#define RC_CHANS    12
+#endif
+
+// last page holds the config, the FLASHLOG_PAGES below it the flight log
+#ifndef FLASH_PAGE_COUNT
+#define FLASH_PAGE_COUNT 64
+#endif
+#define FLASH_PAGE_SIZE     ((uint16_t)0x400)
+
 typedef enum {
     SENSOR_ACC = 1 << 0,
     SENSOR_BARO = 1 << 1,
@@ -36,13 +47,18 @@ typedef enum {
     FEATURE_CAMTRIG = 1 << 6,
     FEATURE_GYRO_SMOOTHING = 1 << 7,
     FEATURE_LED_RING = 1 << 8,
-    FEATURE_GPS = 1 << 9
+    FEATURE_GPS = 1 << 9,
+    FEATURE_DYNAMIC_NOTCH = 1 << 10,
+    FEATURE_SBUS = 1 << 11,
+    FEATURE_BLACKBOX = 1 << 12
 } AvailableFeatures;
 
 typedef void (* sensorInitFuncPtr)(void);                   // sensor init prototype
 typedef void (* sensorReadFuncPtr)(int16_t *data);          // sensor read and align prototype
-typedef void (* uartReceiveCallbackPtr)(uint16_t data);     // used by uart2 driver to return frames to app
+typedef void (* uartReceiveCallbackPtr)(const uint8_t *data, uint16_t len, uint32_t idleTime); // used by uart2 driver to return data to app, idleTime is micros() of the idle line that ended it or 0
 typedef uint16_t (* rcReadRawDataPtr)(uint8_t chan);        // used by receiver driver to return channel data
+typedef bool (* rcFrameCompletePtr)(void);                  // used by receiver driver to signal a new frame
+typedef uint32_t (* rcFrameTimePtr)(void);                  // used by receiver driver to return micros() when the last frame was captured
 
 typedef struct sensor_t
 {
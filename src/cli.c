@@ -3,12 +3,15 @@
 
 // we unset this on 'exit'
 extern uint8_t cliMode;
+static void cliAux(char *cmdline);
 static void cliDefaults(char *cmdline);
 static void cliExit(char *cmdline);
 static void cliFeature(char *cmdline);
 static void cliHelp(char *cmdline);
+static void cliLog(char *cmdline);
 static void cliMap(char *cmdline);
 static void cliMixer(char *cmdline);
+static void cliMMix(char *cmdline);
 static void cliSave(char *cmdline);
 static void cliSet(char *cmdline);
 static void cliStatus(char *cmdline);
@@ -17,6 +20,9 @@ static void cliVersion(char *cmdline);
 // from sensors.c
 extern uint8_t batteryCellCount;
 
+// from sbus.c
+extern uint16_t sbusFrameLostCount, sbusFailsafeCount;
+
 // from config.c RC Channel mapping
 extern const char rcChannelLetters[];
 
@@ -29,16 +35,22 @@ const char *mixerNames[] = {
     "TRI", "QUADP", "QUADX", "BI",
     "GIMBAL", "Y6", "HEX6",
     "FLYING_WING", "Y4", "HEX6X", "OCTOX8", "OCTOFLATP", "OCTOFLATX",
-    "AIRPLANE", "HELI_120_CCPM", "HELI_90_DEG", "VTAIL4", NULL
+    "AIRPLANE", "HELI_120_CCPM", "HELI_90_DEG", "VTAIL4", "CUSTOM", NULL
 };
 
 // sync this with AvailableFeatures enum from board.h
 const char *featureNames[] = {
     "PPM", "VBAT", "INFLIGHT_ACC_CAL", "SPEKTRUM", "MOTOR_STOP",
     "SERVO_TILT", "CAMTRIG", "GYRO_SMOOTHING", "LED_RING", "GPS",
+    "DYNAMIC_NOTCH", "SBUS", "BLACKBOX",
     NULL
 };
 
+// sync this with rxType_e enum from mw.h
+const char *rxTypeNames[] = {
+    "PWM", "PPM", "SPEKTRUM", "SBUS", NULL
+};
+
 // sync this with AvailableSensors enum from board.h
 const char *sensorNames[] = {
     "ACC", "BARO", "MAG", "SONAR", "GPS", NULL
@@ -52,12 +64,15 @@ typedef struct {
 
 // should be sorted a..z for bsearch()
 const clicmd_t cmdTable[] = {
+    { "aux", "box auxchannel mask(1=low 2=mid 4=high) or blank for list", cliAux },
     { "defaults", "reset to defaults and reboot", cliDefaults },
     { "exit", "", cliExit },
     { "feature", "list or -val or val", cliFeature },
     { "help", "", cliHelp },
+    { "log", "show flight log, or erase", cliLog },
     { "map", "mapping of rc channel order", cliMap },
     { "mixer", "mixer name or list", cliMixer },
+    { "mmix", "motor thr roll pitch yaw, load mixername, reset or blank for list", cliMMix },
     { "save", "save and reboot", cliSave },
     { "set", "name=value or blank for list", cliSet },
     { "status", "show system status", cliStatus },
@@ -92,7 +107,9 @@ const clivalue_t valueTable[] = {
     { "maxcheck", VAR_UINT16, &cfg.maxcheck, 0, 2000 },
     { "motor_pwm_rate", VAR_UINT16, &cfg.motor_pwm_rate, 50, 498 },
     { "servo_pwm_rate", VAR_UINT16, &cfg.servo_pwm_rate, 50, 498 },
+    { "motor_oneshot", VAR_UINT8, &cfg.motor_oneshot, 0, 2 },
     { "spektrum_hires", VAR_UINT8, &cfg.spektrum_hires, 0, 1 },
+    { "rc_interpolation", VAR_UINT8, &cfg.rc_interpolation, 0, 1 },
     { "vbatscale", VAR_UINT8, &cfg.vbatscale, 10, 200 },
     { "vbatmaxcellvoltage", VAR_UINT8, &cfg.vbatmaxcellvoltage, 10, 50 },
     { "vbatmincellvoltage", VAR_UINT8, &cfg.vbatmincellvoltage, 10, 50 },
@@ -112,9 +129,13 @@ const clivalue_t valueTable[] = {
     { "gimbal_roll_max", VAR_UINT16, &cfg.gimbal_roll_max, 100, 3000 },
     { "gimbal_roll_mid", VAR_UINT16, &cfg.gimbal_roll_mid, 100, 3000 },
     { "acc_lpf_factor", VAR_UINT8, &cfg.acc_lpf_factor, 0, 250 },
+    { "acc_sample_div", VAR_UINT8, &cfg.acc_sample_div, 1, 50 },
     { "gyro_lpf", VAR_UINT16, &cfg.gyro_lpf, 0, 256 },
+    { "notch_min_hz", VAR_UINT16, &cfg.notch_min_hz, 20, 500 },
+    { "notch_q", VAR_UINT8, &cfg.notch_q, 5, 100 },
     { "gps_baudrate", VAR_UINT32, &cfg.gps_baudrate, 1200, 115200 },
     { "serial_baudrate", VAR_UINT32, &cfg.serial_baudrate, 1200, 115200 },
+    { "blackbox_rate_div", VAR_UINT8, &cfg.blackbox_rate_div, 1, 32 },
     { "p_pitch", VAR_UINT8, &cfg.P8[PITCH], 0, 200},
     { "i_pitch", VAR_UINT8, &cfg.I8[PITCH], 0, 200},
     { "d_pitch", VAR_UINT8, &cfg.D8[PITCH], 0, 200},
@@ -183,6 +204,42 @@ static int cliCompare(const void *a, const void *b)
     return strncasecmp(ca->name, cb->name, strlen(cb->name));
 }
 
+static void cliAux(char *cmdline)
+{
+    uint8_t i, box, aux = 0, shift;
+    char *ptr = NULL;
+    char buf[4];
+
+    if (strlen(cmdline) > 0) {
+        box = atoi(cmdline);
+        ptr = strchr(cmdline, ' ');
+        if (ptr) {
+            aux = atoi(++ptr);
+            ptr = strchr(ptr, ' ');
+        }
+        if (!ptr || box >= CHECKBOXITEMS || aux < 1 || aux > RC_CHANS - 4) {
+            uartPrint("Invalid box or aux channel...\r\n");
+            return;
+        }
+        aux--;
+        shift = (aux & 1) * 3;
+        cfg.activate[box][aux / 2] = (cfg.activate[box][aux / 2] & ~(7 << shift)) | ((atoi(++ptr) & 7) << shift);
+    }
+
+    uartPrint("Box: AUX1..AUX");
+    itoa(RC_CHANS - 4, buf, 10);
+    uartPrint(buf);
+    uartPrint(" masks\r\n");
+    for (box = 0; box < CHECKBOXITEMS; box++) {
+        itoa(box, buf, 10);
+        uartPrint(buf);
+        uartPrint(": ");
+        for (i = 0; i < RC_CHANS - 4; i++)
+            uartWrite('0' + ((cfg.activate[box][i / 2] >> ((i & 1) * 3)) & 7));
+        uartPrint("\r\n");
+    }
+}
+
 static void cliDefaults(char *cmdline)
 {
     uartPrint("Resetting to defaults...\r\n");
@@ -272,7 +329,68 @@ static void cliHelp(char *cmdline)
         uartWrite('\t');
         uartPrint(cmdTable[i].param);
         uartPrint("\r\n");
-        while (!uartTransmitEmpty());
+    }
+}
+
+// sync this with flashLogEvent_e enum from mw.h
+static const char *flashLogEventNames[] = {
+    "?", "BOOT", "ARM", "DISARM", "FAILSAFE", "I2C_ERROR", "LOOP_OVERRUN"
+};
+
+static void cliLog(char *cmdline)
+{
+    flashLogRecord_t rec;
+    char buf[16];
+    uint16_t i;
+
+    if (strncasecmp(cmdline, "erase", 5) == 0) {
+        flashLogErase();
+        uartPrint("Flight log erased\r\n");
+        return;
+    }
+
+    uartPrint("Seq\tTime(ms)\tEvent\r\n");
+    for (i = 0; flashLogRead(i, &rec); i++) {
+        if (rec.type == FLASHLOG_BLANK || rec.type > FLASHLOG_LOOP_OVERRUN)
+            continue;
+        itoa(rec.seq, buf, 10);
+        uartPrint(buf);
+        uartWrite('\t');
+        itoa(rec.time, buf, 10);
+        uartPrint(buf);
+        uartWrite('\t');
+        uartPrint((char *)flashLogEventNames[rec.type]);
+        if (rec.type == FLASHLOG_DISARM) {
+            uartPrint(" flight ");
+            itoa(rec.data[0] & 0xFFFF, buf, 10);
+            uartPrint(buf);
+            uartPrint("s, max cycle ");
+            itoa(rec.data[0] >> 16, buf, 10);
+            uartPrint(buf);
+            uartPrint("us, min vbat ");
+            itoa(rec.data[1] & 0xFF, buf, 10);
+            uartPrint(buf);
+            uartPrint(", failsafe ");
+            itoa(rec.param, buf, 10);
+            uartPrint(buf);
+            uartPrint(", i2c errors ");
+            itoa((rec.data[1] >> 8) & 0xFF, buf, 10);
+            uartPrint(buf);
+            uartPrint(", overruns ");
+            itoa(rec.data[1] >> 16, buf, 10);
+            uartPrint(buf);
+        } else {
+            uartWrite(' ');
+            itoa(rec.data[0], buf, 10);
+            uartPrint(buf);
+        }
+        uartPrint("\r\n");
+    }
+    if (flashLogLostRecords()) {
+        uartPrint("Lost records: ");
+        itoa(flashLogLostRecords(), buf, 10);
+        uartPrint(buf);
+        uartPrint("\r\n");
     }
 }
 
@@ -280,24 +398,29 @@ static void cliMap(char *cmdline)
 {
     uint8_t len;
     uint8_t i;
-    char out[9];
+    char out[RC_CHANS + 1];
 
     len = strlen(cmdline);
 
-    if (len == 8) {
+    if (len > 0) {
         // uppercase it
-        for (i = 0; i < 8; i++)
+        for (i = 0; i < len; i++)
             cmdline[i] = toupper(cmdline[i]);
-        for (i = 0; i < 8; i++) {
-            if (strchr(rcChannelLetters, cmdline[i]) && !strchr(cmdline + i + 1, cmdline[i]))
+        // 4 letters at least, channels left out keep their current input
+        for (i = 0; i < len; i++) {
+            if (len >= 4 && len <= RC_CHANS && memchr(rcChannelLetters, cmdline[i], RC_CHANS) && !strchr(cmdline + i + 1, cmdline[i]))
                 continue;
-            uartPrint("Must be any order of AETR1234\r\n");
+            memcpy(out, rcChannelLetters, RC_CHANS);
+            out[RC_CHANS] = '\0';
+            uartPrint("Must be 4 or more of ");
+            uartPrint(out);
+            uartPrint(" in any order\r\n");
             return;
         }
         parseRcChannels(cmdline);
     }
     uartPrint("Current assignment: ");
-    for (i = 0; i < 8; i++)
+    for (i = 0; i < RC_CHANS; i++)
         out[cfg.rcmap[i]] = rcChannelLetters[i];
     out[i] = '\0';
     uartPrint(out);
@@ -343,6 +466,130 @@ static void cliMixer(char *cmdline)
     }
 }
 
+// parse [-]12.345 into a Q8 mixer coefficient
+static int16_t cliParseMix(const char *s)
+{
+    int32_t milli = 0, scale = 1000;
+    bool neg = false;
+
+    if (*s == '-' || *s == '+')
+        neg = *s++ == '-';
+    // stop growing past the clamp below, more digits would overflow
+    for (; isdigit((unsigned char)*s); s++) {
+        if (milli <= 127998)
+            milli = milli * 10 + (*s - '0') * 1000;
+    }
+    if (*s == '.') {
+        s++;
+        while (isdigit((unsigned char)*s) && scale > 1) {
+            scale /= 10;
+            milli += (*s++ - '0') * scale;
+        }
+    }
+    milli = min(milli, 127998);         // largest that still rounds to 32767
+    milli = (milli * (1 << MIXER_SHIFT) + 500) / 1000;
+    return neg ? -milli : milli;
+}
+
+static void cliPrintMix(int16_t value)
+{
+    char buf[8];
+    uint32_t milli = ((uint32_t)abs(value) * 1000 + (1 << (MIXER_SHIFT - 1))) >> MIXER_SHIFT;
+
+    if (value < 0)
+        uartWrite('-');
+    itoa(milli / 1000, buf, 10);
+    uartPrint(buf);
+    uartWrite('.');
+    buf[0] = '0' + milli / 100 % 10;
+    buf[1] = '0' + milli / 10 % 10;
+    buf[2] = '0' + milli % 10;
+    buf[3] = '\0';
+    uartPrint(buf);
+}
+
+static void cliMMix(char *cmdline)
+{
+    uint8_t i, len;
+    int16_t values[4];
+    char *ptr;
+    char buf[4];
+
+    len = strlen(cmdline);
+
+    if (len == 0) {
+        uartPrint("Custom mixer:\r\nMotor\tThr\tRoll\tPitch\tYaw\r\n");
+        for (i = 0; i < MAX_MOTORS; i++) {
+            if (cfg.customMixer[i].throttle == 0)
+                break;
+            itoa(i, buf, 10);
+            uartPrint(buf);
+            uartWrite('\t');
+            cliPrintMix(cfg.customMixer[i].throttle);
+            uartWrite('\t');
+            cliPrintMix(cfg.customMixer[i].roll);
+            uartWrite('\t');
+            cliPrintMix(cfg.customMixer[i].pitch);
+            uartWrite('\t');
+            cliPrintMix(cfg.customMixer[i].yaw);
+            uartPrint("\r\n");
+        }
+        return;
+    } else if (isdigit((unsigned char)cmdline[0])) {
+        ptr = cmdline;
+        if (atoi(ptr) >= MAX_MOTORS) {
+            uartPrint("Motor number must be 0-");
+            itoa(MAX_MOTORS - 1, buf, 10);
+            uartPrint(buf);
+            uartPrint("\r\n");
+            return;
+        }
+        i = atoi(ptr);
+        // the mix ends at the first motor without throttle, anything after a gap would be ignored
+        if (i > 0 && cfg.customMixer[i - 1].throttle == 0) {
+            uartPrint("Set motor ");
+            itoa(i - 1, buf, 10);
+            uartPrint(buf);
+            uartPrint(" first\r\n");
+            return;
+        }
+        for (len = 0; len < 4; len++) {
+            ptr = strchr(ptr, ' ');
+            if (!ptr)
+                break;
+            values[len] = cliParseMix(++ptr);
+        }
+        if (len < 4) {
+            uartPrint("Need thr roll pitch yaw\r\n");
+            return;
+        }
+        cfg.customMixer[i].throttle = values[0];
+        cfg.customMixer[i].roll = values[1];
+        cfg.customMixer[i].pitch = values[2];
+        cfg.customMixer[i].yaw = values[3];
+    } else if (strncasecmp(cmdline, "reset", len) == 0) {
+        memset(cfg.customMixer, 0, sizeof(cfg.customMixer));
+    } else if (strncasecmp(cmdline, "load ", 5) == 0) {
+        ptr = cmdline + 5;
+        len = strlen(ptr);
+        for (i = 0; ; i++) {
+            if (mixerNames[i] == NULL) {
+                uartPrint("Invalid mixer type...\r\n");
+                return;
+            }
+            if (len && strncasecmp(ptr, mixerNames[i], len) == 0) {
+                mixerLoadMix(i + 1);
+                break;
+            }
+        }
+    } else {
+        uartPrint("Invalid mmix command...\r\n");
+        return;
+    }
+
+    cliMMix("");
+}
+
 static void cliSave(char *cmdline)
 {
     uartPrint("Saving...");
@@ -419,7 +666,6 @@ static void cliSet(char *cmdline)
             uartPrint(" = ");
             cliPrintVar(val);
             uartPrint("\r\n");
-            while (!uartTransmitEmpty());
         }
     } else if ((eqptr = strstr(cmdline, "="))) {
         // has equal, set var
@@ -450,6 +696,7 @@ static void cliStatus(char *cmdline)
     char buf[16];
     uint8_t i;
     uint32_t mask;
+    uint32_t txOverflows, txDrops;
 
     uartPrint("System Uptime: ");
     itoa(millis() / 1000, buf, 10);
@@ -480,7 +727,129 @@ static void cliStatus(char *cmdline)
     uartPrint(", I2C Errors: ");
     itoa(i2cGetErrorCounter(), buf, 10);
     uartPrint(buf);
+    uartGetTxStats(&txOverflows, &txDrops);
+    uartPrint(", UART TX overflows/drops: ");
+    itoa(txOverflows, buf, 10);
+    uartPrint(buf);
+    uartWrite('/');
+    itoa(txDrops, buf, 10);
+    uartPrint(buf);
+    if (feature(FEATURE_SPEKTRUM) || feature(FEATURE_SBUS) || feature(FEATURE_GPS)) {
+        uartPrint(", UART2 RX overruns: ");
+        itoa(uart2GetOverruns(), buf, 10);
+        uartPrint(buf);
+    }
     uartPrint("\r\n");
+
+    uartPrint("IMU updates/skipped: ACC ");
+    itoa(imuAccUpdates, buf, 10);
+    uartPrint(buf);
+    uartWrite('/');
+    itoa(imuAccSkips, buf, 10);
+    uartPrint(buf);
+    uartPrint(", MAG ");
+    itoa(imuMagUpdates, buf, 10);
+    uartPrint(buf);
+    uartWrite('/');
+    itoa(imuMagSkips, buf, 10);
+    uartPrint(buf);
+    uartPrint("\r\n");
+
+    uartPrint("RC frame interval: ");
+    itoa(rcFrameInterval, buf, 10);
+    uartPrint(buf);
+    uartPrint("us, ");
+    uartPrint((char *)rxTypeNames[rcReceiverType]);
+    uartPrint(" latency min/avg/max: ");
+    itoa(rcLatencyMax ? rcLatencyMin : 0, buf, 10);
+    uartPrint(buf);
+    uartWrite('/');
+    itoa(rcLatencyAvg, buf, 10);
+    uartPrint(buf);
+    uartWrite('/');
+    itoa(rcLatencyMax, buf, 10);
+    uartPrint(buf);
+    uartPrint("us\r\n");
+
+    if (!feature(FEATURE_SPEKTRUM) && !feature(FEATURE_SBUS)) {
+        uint32_t avgCycles, maxCycles;
+        pwmGetISRCycles(&avgCycles, &maxCycles);
+        uartPrint("RX capture ISR cycles avg/max: ");
+        itoa(avgCycles, buf, 10);
+        uartPrint(buf);
+        uartWrite('/');
+        itoa(maxCycles, buf, 10);
+        uartPrint(buf);
+        uartPrint("\r\n");
+    }
+
+    if (feature(FEATURE_PPM)) {
+        ppmStats_t ppm;
+        pwmGetPPMStats(&ppm);
+        uartPrint("PPM frames: ");
+        itoa(ppm.frames, buf, 10);
+        uartPrint(buf);
+        uartPrint(", short: ");
+        itoa(ppm.shortFrames, buf, 10);
+        uartPrint(buf);
+        uartPrint(", malformed: ");
+        itoa(ppm.malformedFrames, buf, 10);
+        uartPrint(buf);
+        uartPrint(", channels: ");
+        itoa(ppm.channels, buf, 10);
+        uartPrint(buf);
+        uartPrint("\r\nPPM interval min/avg/max: ");
+        itoa(ppm.frames > 1 ? ppm.intervalMin : 0, buf, 10);
+        uartPrint(buf);
+        uartWrite('/');
+        itoa(ppm.intervalAvg, buf, 10);
+        uartPrint(buf);
+        uartWrite('/');
+        itoa(ppm.intervalMax, buf, 10);
+        uartPrint(buf);
+        uartPrint("us, jitter: ");
+        itoa(ppm.jitterAvg, buf, 10);
+        uartPrint(buf);
+        uartPrint("us\r\n");
+    }
+
+    if (feature(FEATURE_SBUS)) {
+        uartPrint("SBUS frames lost: ");
+        itoa(sbusFrameLostCount, buf, 10);
+        uartPrint(buf);
+        uartPrint(", failsafe: ");
+        itoa(sbusFailsafeCount, buf, 10);
+        uartPrint(buf);
+        uartPrint("\r\n");
+    }
+
+    if (feature(FEATURE_BLACKBOX)) {
+        uint32_t written, dropped, avgCycles, maxCycles;
+        blackboxGetStats(&written, &dropped, &avgCycles, &maxCycles);
+        uartPrint("Blackbox frames/dropped: ");
+        itoa(written, buf, 10);
+        uartPrint(buf);
+        uartWrite('/');
+        itoa(dropped, buf, 10);
+        uartPrint(buf);
+        uartPrint(", cycles avg/max: ");
+        itoa(avgCycles, buf, 10);
+        uartPrint(buf);
+        uartWrite('/');
+        itoa(maxCycles, buf, 10);
+        uartPrint(buf);
+        uartPrint("\r\n");
+    }
+
+    if (feature(FEATURE_DYNAMIC_NOTCH)) {
+        uartPrint("Gyro notch (Hz): ");
+        for (i = 0; i < 3; i++) {
+            itoa(notchCenterHz[i], buf, 10);
+            uartPrint(buf);
+            uartWrite(' ');
+        }
+        uartPrint("\r\n");
+    }
 }
 
 static void cliVersion(char *cmdline)
@@ -2,39 +2,66 @@
 #include "mw.h"
 #include <string.h>
 
-#ifndef FLASH_PAGE_COUNT
-#define FLASH_PAGE_COUNT 64
-#endif
-
-#define FLASH_PAGE_SIZE                 ((uint16_t)0x400)
 #define FLASH_WRITE_ADDR                (0x08000000 + (uint32_t)FLASH_PAGE_SIZE * (FLASH_PAGE_COUNT - 1))    // use the last KB for storage
 
 config_t cfg;
-const char rcChannelLetters[] = "AERT1234";
+const char rcChannelLetters[] = "AERT123456789JKL";  // only the first RC_CHANS are used
 
 static uint32_t enabledSensors = 0;
-static uint8_t checkNewConf = 13;
+static uint8_t checkNewConf = 20;
 
+// input may name fewer than RC_CHANS channels, the rest keep their assignment
 void parseRcChannels(const char *input)
 {
     const char *c, *s;
+    uint8_t i, j, in, len = strlen(input);
 
     for (c = input; *c; c++) {
-        s = strchr(rcChannelLetters, *c);
+        s = memchr(rcChannelLetters, *c, RC_CHANS);
         if (s)                          
             cfg.rcmap[s - rcChannelLetters] = c - input;
     }
+
+    // an unnamed channel whose input was just taken moves to the first free input
+    for (i = 0; i < RC_CHANS; i++) {
+        if (cfg.rcmap[i] >= len || memchr(input, rcChannelLetters[i], len))
+            continue;
+        for (in = len; in < RC_CHANS; in++) {
+            for (j = 0; j < RC_CHANS && cfg.rcmap[j] != in; j++);
+            if (j == RC_CHANS) {
+                cfg.rcmap[i] = in;
+                break;
+            }
+        }
+    }
 }
 
-void readEEPROM(void)
+// roll/pitch expo curve and throttle curve per stick position. annexCode() still computes the rate and TPA attenuation.
+static void generateLookupTables(void)
 {
-    uint8_t i;
+    int16_t lookupRX[7];
+    uint16_t i, tmp, tmp2;
 
+    for (i = 0; i < 7; i++)
+        lookupRX[i] = (2500 + cfg.rcExpo8 * (i * i - 25)) * i * (int32_t) cfg.rcRate8 / 1250;
+
+    for (i = 0; i < RC_LOOKUP_LENGTH; i++) {
+        // roll/pitch expo curve acts on the stick deflection past the deadband
+        tmp = i > cfg.deadband ? i - cfg.deadband : 0;
+        tmp2 = tmp / 100;
+        lookupPitchRollRC[i] = lookupRX[tmp2] + (tmp - tmp2 * 100) * (lookupRX[tmp2 + 1] - lookupRX[tmp2]) / 100;
+    }
+
+    for (i = 0; i < THROTTLE_LOOKUP_LENGTH; i++)
+        lookupThrottleRC[i] = cfg.minthrottle + (int32_t)(cfg.maxthrottle - cfg.minthrottle) * (i + 1000 - cfg.mincheck) / (2000 - cfg.mincheck);
+}
+
+void readEEPROM(void)
+{
     // Read flash
     memcpy(&cfg, (char *)FLASH_WRITE_ADDR, sizeof(config_t));
 
-    for (i = 0; i < 7; i++)
-        lookupRX[i] = (2500 + cfg.rcExpo8 * (i * i - 25)) * i * (int32_t) cfg.rcRate8 / 1250;
+    generateLookupTables();
 
     cfg.wing_left_mid = constrain(cfg.wing_left_mid, WING_LEFT_MIN, WING_LEFT_MAX);     //LEFT 
     cfg.wing_right_mid = constrain(cfg.wing_right_mid, WING_RIGHT_MIN, WING_RIGHT_MAX); //RIGHT
@@ -106,27 +133,30 @@ void checkFirstTime(bool reset)
     cfg.rollPitchRate = 0;
     cfg.yawRate = 0;
     cfg.dynThrPID = 0;
-    for (i = 0; i < CHECKBOXITEMS; i++) {
-        cfg.activate1[i] = 0;
-        cfg.activate2[i] = 0;
-    }
+    memset(cfg.activate, 0, sizeof(cfg.activate));
     cfg.accTrim[0] = 0;
     cfg.accTrim[1] = 0;
     cfg.accZero[0] = 0;
     cfg.accZero[1] = 0;
     cfg.accZero[2] = 0;
     cfg.acc_lpf_factor = 4;
+    cfg.acc_sample_div = 1;
     cfg.gyro_lpf = 42;
     cfg.gyro_smoothing_factor = 0x00141403; // default factors of 20, 20, 3 for R/P/Y
+    cfg.notch_min_hz = 80;
+    cfg.notch_q = 20;
     cfg.vbatscale = 110;
     cfg.vbatmaxcellvoltage = 43;
     cfg.vbatmincellvoltage = 33;
 
     // Radio
+    for (i = 0; i < RC_CHANS; i++)
+        cfg.rcmap[i] = i;
     parseRcChannels("AETR1234");
     cfg.deadband = 0;
     cfg.yawdeadband = 0;
     cfg.spektrum_hires = 0;
+    cfg.rc_interpolation = 1;
     cfg.midrc = 1500;
     cfg.mincheck = 1100;
     cfg.maxcheck = 1900;
@@ -137,9 +167,11 @@ void checkFirstTime(bool reset)
     cfg.mincommand = 1000;
     cfg.motor_pwm_rate = 400;
     cfg.servo_pwm_rate = 50;
+    cfg.motor_oneshot = 0;
 
     // servos
     cfg.yaw_direction = 1;
+    memset(cfg.customMixer, 0, sizeof(cfg.customMixer));
     cfg.wing_left_mid = 1500;
     cfg.wing_right_mid = 1500;
     cfg.tri_yaw_middle = 1500;
@@ -162,6 +194,7 @@ void checkFirstTime(bool reset)
 
     // serial(uart1) baudrate
     cfg.serial_baudrate = 115200;
+    cfg.blackbox_rate_div = 2;
 
     writeParams();
 }
@@ -1,6 +1,9 @@
 #include "board.h"
 
 #define PULSE_1MS       (1000) // 1ms pulse width
+#define ONESHOT_MAX_PULSE       2100    // timer ticks, don't restart a motor timer while its pulse is still going
+#define PPM_MIN_CHANNELS        4       // anything shorter is not a usable frame
+#define PPM_MAX_FRAME_INTERVAL  50000   // longer gaps are dropouts, not jitter
 // #define PULSE_PERIOD    (2500) // pulse period (400Hz)
 // #define PULSE_PERIOD_SERVO_DIGITAL  (5000) // pulse period for digital servo (200Hz)
 // #define PULSE_PERIOD_SERVO_ANALOG  (20000) // pulse period for analog servo (50Hz)
@@ -14,29 +17,53 @@ static struct TIM_Channel {
     TIM_TypeDef *tim;
     uint16_t channel;
     uint16_t cc;
+    volatile uint16_t *ccr;
+    uint16_t ccerPolarity;
 } Channels[] = {
-    { TIM2, TIM_Channel_1, TIM_IT_CC1 },
-    { TIM2, TIM_Channel_2, TIM_IT_CC2 },
-    { TIM2, TIM_Channel_3, TIM_IT_CC3 },
-    { TIM2, TIM_Channel_4, TIM_IT_CC4 },
-    { TIM3, TIM_Channel_1, TIM_IT_CC1 },
-    { TIM3, TIM_Channel_2, TIM_IT_CC2 },
-    { TIM3, TIM_Channel_3, TIM_IT_CC3 },
-    { TIM3, TIM_Channel_4, TIM_IT_CC4 },
+    { TIM2, TIM_Channel_1, TIM_IT_CC1, &(TIM2->CCR1), TIM_CCER_CC1P },
+    { TIM2, TIM_Channel_2, TIM_IT_CC2, &(TIM2->CCR2), TIM_CCER_CC2P },
+    { TIM2, TIM_Channel_3, TIM_IT_CC3, &(TIM2->CCR3), TIM_CCER_CC3P },
+    { TIM2, TIM_Channel_4, TIM_IT_CC4, &(TIM2->CCR4), TIM_CCER_CC4P },
+    { TIM3, TIM_Channel_1, TIM_IT_CC1, &(TIM3->CCR1), TIM_CCER_CC1P },
+    { TIM3, TIM_Channel_2, TIM_IT_CC2, &(TIM3->CCR2), TIM_CCER_CC2P },
+    { TIM3, TIM_Channel_3, TIM_IT_CC3, &(TIM3->CCR3), TIM_CCER_CC3P },
+    { TIM3, TIM_Channel_4, TIM_IT_CC4, &(TIM3->CCR4), TIM_CCER_CC4P },
 };
 
-static volatile uint16_t *OutputChannels[] = {
-    &(TIM1->CCR1),
-    &(TIM1->CCR4),
-    &(TIM4->CCR1),
-    &(TIM4->CCR2),
-    &(TIM4->CCR3),
-    &(TIM4->CCR4),
+// Output compare values are staged by pwmWrite() and copied into the active block by pwmCompleteMotorUpdate().
+// On every update event the timer requests a DMA burst of the active block into CCR1..CCR4,
+// so all outputs of a timer change together at the start of a period without the CPU touching the timer.
+// TIM1_UP shares DMA1 channel 5 with USART1 RX, so TIM1 keeps compare preload and gets the block written by the CPU,
+// which the update event latches just the same.
+typedef union {
+    uint16_t ccr[4];
+    uint32_t word[2];
+} pwmBurst_t;
+
+static struct PWM_Burst {
+    TIM_TypeDef *tim;
+    DMA_Channel_TypeDef *dma;                   // DMA1 channel of the timer's update request, 0 for CPU writes
+} Bursts[] = {
+    { TIM1, 0 },
+    { TIM4, DMA1_Channel7 },
     // Extended use during CPPM input
-    &(TIM3->CCR1),
-    &(TIM3->CCR2),
-    &(TIM3->CCR3),
-    &(TIM3->CCR4),
+    { TIM3, DMA1_Channel3 },
+};
+
+static pwmBurst_t burstStaged[3];
+static volatile pwmBurst_t burstActive[3];
+
+static uint16_t *OutputChannels[] = {
+    &burstStaged[0].ccr[0],
+    &burstStaged[0].ccr[3],
+    &burstStaged[1].ccr[0],
+    &burstStaged[1].ccr[1],
+    &burstStaged[1].ccr[2],
+    &burstStaged[1].ccr[3],
+    &burstStaged[2].ccr[0],
+    &burstStaged[2].ccr[1],
+    &burstStaged[2].ccr[2],
+    &burstStaged[2].ccr[3],
 };
 
 static struct PWM_State {
@@ -44,24 +71,99 @@ static struct PWM_State {
     uint16_t rise;
     uint16_t fall;
     uint16_t capture;
-} Inputs[8] = { { 0, } };
+} Inputs[RC_CHANS] = { { 0, } };
 
 static TIM_ICInitTypeDef  TIM_ICInitStructure = { 0, };
 static bool usePPMFlag = false;
 static uint8_t numOutputChannels = 0;
 static volatile bool rcActive = false;
+static volatile uint16_t frameSeq = 0;
+static uint16_t frameSeqSeen = 0;
+static volatile uint32_t frameTime = 0;         // micros() when the last frame was captured
+static volatile uint32_t isrCyclesAvgX16 = 0, isrCyclesMax = 0;
+static TIM_TypeDef *oneShotTimers[3];           // motor-only timers fired by pwmCompleteMotorUpdate()
+static uint8_t numOneShotTimers = 0;
+static uint8_t numBursts = 0;
+
+// PPM frames are collected in ppmPending and published whole into one half of ppmFrame
+static uint16_t ppmPending[RC_CHANS];
+static volatile uint16_t ppmFrame[2][RC_CHANS];
+static volatile uint8_t ppmFrameBuffer = 0;     // half the ISR published last
+static uint8_t ppmReadBuffer = 0;               // half latched by pwmFrameComplete()
+static volatile ppmStats_t ppmStats;
+static uint32_t ppmIntervalAvgX16 = 0, ppmJitterAvgX16 = 0;
+
+// cost of the input capture interrupts in cpu cycles, for 'status' in the CLI
+static void isrCyclesUpdate(uint32_t cycles)
+{
+    isrCyclesAvgX16 += cycles - (isrCyclesAvgX16 >> 4);
+    if (cycles > isrCyclesMax)
+        isrCyclesMax = cycles;
+}
 
 void TIM2_IRQHandler(void)
 {
+    uint32_t start = cycleCount();
+
     if (usePPMFlag)
         ppmIRQHandler(TIM2);
     else
         pwmIRQHandler(TIM2);
+    isrCyclesUpdate(cycleCount() - start);
 }
 
 void TIM3_IRQHandler(void)
 {
+    uint32_t start = cycleCount();
+
     pwmIRQHandler(TIM3);
+    isrCyclesUpdate(cycleCount() - start);
+}
+
+static void ppmFrameDone(uint8_t count, bool malformed)
+{
+    static bool lastFrameGood = false;
+    uint32_t now = micros();
+    uint32_t interval, deviation;
+    uint8_t buf, i;
+
+    ppmStats.channels = count;
+    if (malformed || count < PPM_MIN_CHANNELS) {
+        if (malformed)
+            ppmStats.malformedFrames++;
+        else
+            ppmStats.shortFrames++;
+        lastFrameGood = false;
+        return;
+    }
+
+    // fill the idle half, channels missing from this frame keep their last value
+    buf = ppmFrameBuffer ^ 1;
+    for (i = 0; i < RC_CHANS; i++)
+        ppmFrame[buf][i] = i < count ? ppmPending[i] : ppmFrame[ppmFrameBuffer][i];
+    ppmFrameBuffer = buf;
+    frameTime = now;
+    frameSeq++;
+
+    interval = now - ppmStats.frameTime;
+    ppmStats.frameTime = now;
+    ppmStats.frames++;
+
+    // interval statistics only between back to back good frames
+    if (lastFrameGood && interval < PPM_MAX_FRAME_INTERVAL) {
+        if (ppmIntervalAvgX16 == 0)
+            ppmIntervalAvgX16 = interval << 4;
+        ppmIntervalAvgX16 += interval - (ppmIntervalAvgX16 >> 4);
+        deviation = abs((int32_t)interval - (int32_t)(ppmIntervalAvgX16 >> 4));
+        ppmJitterAvgX16 += deviation - (ppmJitterAvgX16 >> 4);
+        ppmStats.intervalAvg = ppmIntervalAvgX16 >> 4;
+        ppmStats.jitterAvg = ppmJitterAvgX16 >> 4;
+        if (interval < ppmStats.intervalMin)
+            ppmStats.intervalMin = interval;
+        if (interval > ppmStats.intervalMax)
+            ppmStats.intervalMax = interval;
+    }
+    lastFrameGood = true;
 }
 
 static void ppmIRQHandler(TIM_TypeDef *tim)
@@ -70,6 +172,7 @@ static void ppmIRQHandler(TIM_TypeDef *tim)
     static uint16_t now;
     static uint16_t last = 0;
     static uint8_t chan = 0;
+    static bool malformed = false;
 
     if (TIM_GetITStatus(tim, TIM_IT_CC1) == SET) {
         last = now;
@@ -86,74 +189,121 @@ static void ppmIRQHandler(TIM_TypeDef *tim)
     }
 
     if (diff > 4000) {
+        // sync gap after at least one channel ends a frame
+        if (chan > 0)
+            ppmFrameDone(chan, malformed);
         chan = 0;
+        malformed = false;
     } else {
-        if (diff > 750 && diff < 2250 && chan < 8) {   // 750 to 2250 ms is our 'valid' channel range
-            Inputs[chan].capture = diff;
+        if (diff > 750 && diff < 2250) {   // 750 to 2250 ms is our 'valid' channel range
+            if (chan < RC_CHANS)
+                ppmPending[chan] = diff;
+        } else {
+            malformed = true;
         }
-        chan++;
+        if (chan < 0xff)
+            chan++;
     }
 }
 
 static void pwmIRQHandler(TIM_TypeDef *tim)
 {
     uint8_t i;
-    uint16_t val = 0;
+    uint16_t status, val;
 
-    for (i = 0; i < 8; i++) {
-        struct TIM_Channel channel = Channels[i];
-        struct PWM_State *state = &Inputs[i];
+    // service only the capture channels flagged in SR. writing 0 clears a flag, 1 leaves it alone
+    status = tim->SR & tim->DIER & (TIM_IT_CC1 | TIM_IT_CC2 | TIM_IT_CC3 | TIM_IT_CC4);
+    tim->SR = (uint16_t)~status;
 
-        if (channel.tim == tim && (TIM_GetITStatus(tim, channel.cc) == SET)) {
-            TIM_ClearITPendingBit(channel.tim, channel.cc);
-            if (i == 0)
-                rcActive = true;
-
-            switch (channel.channel) {
-                case TIM_Channel_1:
-                    val = TIM_GetCapture1(channel.tim);
-                    break;
-                case TIM_Channel_2:
-                    val = TIM_GetCapture2(channel.tim);
-                    break;
-                case TIM_Channel_3:
-                    val = TIM_GetCapture3(channel.tim);
-                    break;
-                case TIM_Channel_4:
-                    val = TIM_GetCapture4(channel.tim);
-                    break;
-            }
+    // CC1IF is bit 1, TIM2 holds inputs 0-3 and TIM3 inputs 4-7
+    status >>= 1;
+    for (i = (tim == TIM2) ? 0 : 4; status; i++, status >>= 1) {
+        const struct TIM_Channel *channel = &Channels[i];
+        struct PWM_State *state = &Inputs[i];
 
-            if (state->state == 0)
-                state->rise = val;
-            else
-                state->fall = val;
-
-            if (state->state == 0) {
-                // switch states
-                state->state = 1;
-
-                TIM_ICInitStructure.TIM_ICPolarity = TIM_ICPolarity_Falling;
-                TIM_ICInitStructure.TIM_Channel = channel.channel;
-                TIM_ICInit(channel.tim, &TIM_ICInitStructure);
-            } else {
-                // compute capture
-                if (state->fall > state->rise)
-                    state->capture = (state->fall - state->rise);
-                else
-                    state->capture = ((0xffff - state->rise) + state->fall);
-
-                // switch state
-                state->state = 0;
-
-                TIM_ICInitStructure.TIM_ICPolarity = TIM_ICPolarity_Rising;
-                TIM_ICInitStructure.TIM_Channel = channel.channel;
-                TIM_ICInit(channel.tim, &TIM_ICInitStructure);
+        if (!(status & 1))
+            continue;
+
+        val = *channel->ccr;
+        if (i == 0)
+            rcActive = true;
+
+        if (state->state == 0) {
+            state->rise = val;
+            state->state = 1;
+            // capture the falling edge next
+            tim->CCER |= channel->ccerPolarity;
+        } else {
+            state->fall = val;
+            // 16bit timer, unsigned wraparound takes care of overflow
+            state->capture = state->fall - state->rise;
+            state->state = 0;
+            tim->CCER &= ~channel->ccerPolarity;
+            // receivers update RX1 first, so its falling edge marks a new frame
+            if (i == 0) {
+                frameTime = micros();
+                frameSeq++;
             }
         }
     }
 }
 
+// in oneshot mode the motor timers never reach their period on their own. pwmCompleteMotorUpdate() restarts them,
+// which bursts the new compare values in and starts one pulse. OneShot125 runs the same ticks 8x faster.
+static void pwmMotorTimeBase(TIM_TypeDef *tim, drv_pwm_config_t *init)
+{
+    TIM_TimeBaseInitTypeDef TIM_TimeBaseStructure = { 0, };
+
+    TIM_TimeBaseStructInit(&TIM_TimeBaseStructure);
+    if (init->motorOneShot == ONESHOT_OFF) {
+        TIM_TimeBaseStructure.TIM_Prescaler = (72 - 1);
+        TIM_TimeBaseStructure.TIM_Period = (1000000 / init->motorPwmRate) - 1;
+    } else {
+        TIM_TimeBaseStructure.TIM_Prescaler = init->motorOneShot == ONESHOT_125 ? (9 - 1) : (72 - 1);
+        TIM_TimeBaseStructure.TIM_Period = 0xFFFF;
+        oneShotTimers[numOneShotTimers++] = tim;
+    }
+    TIM_TimeBaseInit(tim, &TIM_TimeBaseStructure);
+}
+
+// preload is off on the DMA driven channels, the burst lands a few ticks after the update event and takes effect
+// in the period that just started. Even a 125us oneshot pulse is far longer than the burst.
+static void pwmBurstInit(void)
+{
+    DMA_InitTypeDef DMA_InitStructure;
+    struct PWM_Burst *burst = &Bursts[numBursts];
+    uint8_t i;
+
+    for (i = 0; i < 4; i++) {
+        burstStaged[numBursts].ccr[i] = PULSE_1MS;
+        burstActive[numBursts].ccr[i] = PULSE_1MS;
+    }
+
+    if (!burst->dma) {
+        numBursts++;
+        return;
+    }
+
+    DMA_DeInit(burst->dma);
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&burst->tim->DMAR;
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)&burstActive[numBursts];
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+    DMA_InitStructure.DMA_BufferSize = 4;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_Init(burst->dma, &DMA_InitStructure);
+    DMA_Cmd(burst->dma, ENABLE);
+
+    TIM_DMAConfig(burst->tim, TIM_DMABase_CCR1, TIM_DMABurstLength_4Transfers);
+    TIM_DMACmd(burst->tim, TIM_DMA_Update, ENABLE);
+    numBursts++;
+}
+
 static void pwmInitializeInput(bool usePPM)
 {
     GPIO_InitTypeDef GPIO_InitStructure = { 0, };
@@ -297,8 +447,12 @@ bool pwmInit(drv_pwm_config_t *init)
     usePPMFlag = init->usePPM;
 
     // preset channels to center    
-    for (i = 0; i < 8; i++)
+    for (i = 0; i < RC_CHANS; i++) {
         Inputs[i].capture = 1500;
+        ppmFrame[0][i] = 1500;
+        ppmFrame[1][i] = 1500;
+    }
+    ppmStats.intervalMin = 0xffff;
         
     // Timers run at 1mhz.
     // TODO: clean this shit up. Make it all dynamic etc.
@@ -321,13 +475,10 @@ bool pwmInit(drv_pwm_config_t *init)
         // ch1, 2 for servo
         TIM_TimeBaseStructure.TIM_Period = (1000000 / init->servoPwmRate) - 1;
         TIM_TimeBaseInit(TIM1, &TIM_TimeBaseStructure);
-        TIM_TimeBaseStructure.TIM_Period = (1000000 / init->motorPwmRate) - 1;
-        TIM_TimeBaseInit(TIM4, &TIM_TimeBaseStructure);
     } else {
-        TIM_TimeBaseStructure.TIM_Period = (1000000 / init->motorPwmRate) - 1;
-        TIM_TimeBaseInit(TIM1, &TIM_TimeBaseStructure);
-        TIM_TimeBaseInit(TIM4, &TIM_TimeBaseStructure);
+        pwmMotorTimeBase(TIM1, init);
     }
+    pwmMotorTimeBase(TIM4, init);
 
     TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM2;
     TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
@@ -347,10 +498,13 @@ bool pwmInit(drv_pwm_config_t *init)
     TIM_OC2Init(TIM4, &TIM_OCInitStructure);
     TIM_OC3Init(TIM4, &TIM_OCInitStructure);
     TIM_OC4Init(TIM4, &TIM_OCInitStructure);
-    TIM_OC1PreloadConfig(TIM4, TIM_OCPreload_Enable);
-    TIM_OC2PreloadConfig(TIM4, TIM_OCPreload_Enable);
-    TIM_OC3PreloadConfig(TIM4, TIM_OCPreload_Enable);
-    TIM_OC4PreloadConfig(TIM4, TIM_OCPreload_Enable);
+    TIM_OC1PreloadConfig(TIM4, TIM_OCPreload_Disable);
+    TIM_OC2PreloadConfig(TIM4, TIM_OCPreload_Disable);
+    TIM_OC3PreloadConfig(TIM4, TIM_OCPreload_Disable);
+    TIM_OC4PreloadConfig(TIM4, TIM_OCPreload_Disable);
+
+    pwmBurstInit();
+    pwmBurstInit();
 
     TIM_Cmd(TIM1, ENABLE);
     TIM_Cmd(TIM4, ENABLE);
@@ -367,8 +521,7 @@ bool pwmInit(drv_pwm_config_t *init)
         GPIO_InitStructure.GPIO_Pin = GPIO_Pin_0 | GPIO_Pin_1;
         GPIO_Init(GPIOB, &GPIO_InitStructure);
 
-        TIM_TimeBaseStructure.TIM_Period = (1000000 / init->motorPwmRate) - 1;
-        TIM_TimeBaseInit(TIM3, &TIM_TimeBaseStructure);
+        pwmMotorTimeBase(TIM3, init);
 
         TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM2;
         TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
@@ -381,10 +534,11 @@ bool pwmInit(drv_pwm_config_t *init)
         TIM_OC2Init(TIM3, &TIM_OCInitStructure);
         TIM_OC3Init(TIM3, &TIM_OCInitStructure);
         TIM_OC4Init(TIM3, &TIM_OCInitStructure);
-        TIM_OC1PreloadConfig(TIM3, TIM_OCPreload_Enable);
-        TIM_OC2PreloadConfig(TIM3, TIM_OCPreload_Enable);
-        TIM_OC3PreloadConfig(TIM3, TIM_OCPreload_Enable);
-        TIM_OC4PreloadConfig(TIM3, TIM_OCPreload_Enable);
+        TIM_OC1PreloadConfig(TIM3, TIM_OCPreload_Disable);
+        TIM_OC2PreloadConfig(TIM3, TIM_OCPreload_Disable);
+        TIM_OC3PreloadConfig(TIM3, TIM_OCPreload_Disable);
+        TIM_OC4PreloadConfig(TIM3, TIM_OCPreload_Disable);
+        pwmBurstInit();
 
         TIM_Cmd(TIM3, ENABLE);
         TIM_CtrlPWMOutputs(TIM3, ENABLE);
@@ -407,11 +561,66 @@ void pwmWrite(uint8_t channel, uint16_t value)
         *OutputChannels[channel] = value;
 }
 
+void pwmCompleteMotorUpdate(void)
+{
+    uint8_t i;
+
+    // publish everything staged since the last call. two word stores per timer, an update event can only
+    // split them if it lands exactly between the two.
+    for (i = 0; i < numBursts; i++) {
+        if (Bursts[i].dma) {
+            burstActive[i].word[0] = burstStaged[i].word[0];
+            burstActive[i].word[1] = burstStaged[i].word[1];
+        } else {
+            Bursts[i].tim->CCR1 = burstStaged[i].ccr[0];
+            Bursts[i].tim->CCR2 = burstStaged[i].ccr[1];
+            Bursts[i].tim->CCR3 = burstStaged[i].ccr[2];
+            Bursts[i].tim->CCR4 = burstStaged[i].ccr[3];
+        }
+    }
+
+    for (i = 0; i < numOneShotTimers; i++) {
+        // update event reloads the compare registers and restarts the pulse
+        if (oneShotTimers[i]->CNT > ONESHOT_MAX_PULSE)
+            oneShotTimers[i]->EGR = TIM_EGR_UG;
+    }
+}
+
 uint16_t pwmRead(uint8_t channel)
 {
+    if (usePPMFlag)
+        return ppmFrame[ppmReadBuffer][channel];
     return Inputs[channel].capture;
 }
 
+// also latches the PPM frame that pwmRead() returns until the next one
+bool pwmFrameComplete(void)
+{
+    uint16_t seq = frameSeq;
+
+    if (seq == frameSeqSeen)
+        return false;
+    frameSeqSeen = seq;
+    ppmReadBuffer = ppmFrameBuffer;
+    return true;
+}
+
+uint32_t pwmFrameTime(void)
+{
+    return frameTime;
+}
+
+void pwmGetPPMStats(ppmStats_t *stats)
+{
+    memcpy(stats, (void *)&ppmStats, sizeof(ppmStats_t));
+}
+
+void pwmGetISRCycles(uint32_t *avgCycles, uint32_t *maxCycles)
+{
+    *avgCycles = isrCyclesAvgX16 >> 4;
+    *maxCycles = isrCyclesMax;
+}
+
 uint8_t pwmGetNumOutputChannels(void)
 {
     return numOutputChannels;
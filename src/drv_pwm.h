@@ -6,9 +6,33 @@ typedef struct drv_pwm_config_t {
     bool useServos;
     uint16_t motorPwmRate;
     uint16_t servoPwmRate;
+    uint8_t motorOneShot;                   // pwmOneShot_e
 } drv_pwm_config_t;
 
+typedef enum {
+    ONESHOT_OFF = 0,                        // free running PWM at motorPwmRate
+    ONESHOT_PWM,                            // one 1000-2000us pulse per pwmCompleteMotorUpdate()
+    ONESHOT_125                             // same, scaled down 8x to 125-250us
+} pwmOneShot_e;
+
+typedef struct ppmStats_t {
+    uint32_t frames;                        // complete frames published to the RC pipeline
+    uint32_t shortFrames;                   // sync seen after fewer than PPM_MIN_CHANNELS pulses
+    uint32_t malformedFrames;               // frame contained a pulse outside the 750..2250us range
+    uint32_t frameTime;                     // micros() when the last frame was published
+    uint8_t channels;                       // pulse count of the last frame
+    uint16_t intervalMin;                   // us between consecutive good frames
+    uint16_t intervalMax;
+    uint16_t intervalAvg;
+    uint16_t jitterAvg;                     // average deviation of the interval from intervalAvg, us
+} ppmStats_t;
+
 bool pwmInit(drv_pwm_config_t *init); // returns whether driver is asking to calibrate throttle or not
-void pwmWrite(uint8_t channel, uint16_t value);
+void pwmWrite(uint8_t channel, uint16_t value); // staged, all outputs go out together on pwmCompleteMotorUpdate()
+void pwmCompleteMotorUpdate(void);
 uint16_t pwmRead(uint8_t channel);
+bool pwmFrameComplete(void);
+uint32_t pwmFrameTime(void);
+void pwmGetPPMStats(ppmStats_t *stats);
+void pwmGetISRCycles(uint32_t *avgCycles, uint32_t *maxCycles);
 uint8_t pwmGetNumOutputChannels(void);
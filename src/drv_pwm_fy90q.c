@@ -2,6 +2,8 @@
 #include "board.h"
 
 #define PULSE_1MS       (1000) // 1ms pulse width
+#define PPM_MIN_CHANNELS        4       // anything shorter is not a usable frame
+#define PPM_MAX_FRAME_INTERVAL  50000   // longer gaps are dropouts, not jitter
 // #define PULSE_PERIOD    (2500) // pulse period (400Hz)
 // #define PULSE_PERIOD_SERVO_DIGITAL  (5000) // pulse period for digital servo (200Hz)
 // #define PULSE_PERIOD_SERVO_ANALOG  (20000) // pulse period for analog servo (50Hz)
@@ -15,15 +17,17 @@ static struct TIM_Channel {
     TIM_TypeDef *tim;
     uint16_t channel;
     uint16_t cc;
+    volatile uint16_t *ccr;
+    uint16_t ccerPolarity;
 } Channels[] = {
-    { TIM2, TIM_Channel_1, TIM_IT_CC1 },
-    { TIM2, TIM_Channel_2, TIM_IT_CC2 },
-    { TIM2, TIM_Channel_3, TIM_IT_CC3 },
-    { TIM2, TIM_Channel_4, TIM_IT_CC4 },
-    { TIM3, TIM_Channel_1, TIM_IT_CC1 },
-    { TIM3, TIM_Channel_2, TIM_IT_CC2 },
-    { TIM3, TIM_Channel_3, TIM_IT_CC3 },
-    { TIM3, TIM_Channel_4, TIM_IT_CC4 },
+    { TIM2, TIM_Channel_1, TIM_IT_CC1, &(TIM2->CCR1), TIM_CCER_CC1P },
+    { TIM2, TIM_Channel_2, TIM_IT_CC2, &(TIM2->CCR2), TIM_CCER_CC2P },
+    { TIM2, TIM_Channel_3, TIM_IT_CC3, &(TIM2->CCR3), TIM_CCER_CC3P },
+    { TIM2, TIM_Channel_4, TIM_IT_CC4, &(TIM2->CCR4), TIM_CCER_CC4P },
+    { TIM3, TIM_Channel_1, TIM_IT_CC1, &(TIM3->CCR1), TIM_CCER_CC1P },
+    { TIM3, TIM_Channel_2, TIM_IT_CC2, &(TIM3->CCR2), TIM_CCER_CC2P },
+    { TIM3, TIM_Channel_3, TIM_IT_CC3, &(TIM3->CCR3), TIM_CCER_CC3P },
+    { TIM3, TIM_Channel_4, TIM_IT_CC4, &(TIM3->CCR4), TIM_CCER_CC4P },
 };
 
 static volatile uint16_t *OutputChannels[] = {
@@ -43,19 +47,88 @@ static struct PWM_State {
     uint16_t rise;
     uint16_t fall;
     uint16_t capture;
-} Inputs[8] = { { 0, } };
+} Inputs[RC_CHANS] = { { 0, } };
 
 static TIM_ICInitTypeDef  TIM_ICInitStructure = { 0, };
 static bool usePPMFlag = false;
 static uint8_t numOutputChannels = 0;
 static volatile bool rcActive = false;
+static volatile uint16_t frameSeq = 0;
+static uint16_t frameSeqSeen = 0;
+static volatile uint32_t frameTime = 0;         // micros() when the last frame was captured
+static volatile uint32_t isrCyclesAvgX16 = 0, isrCyclesMax = 0;
+
+// PPM frames are collected in ppmPending and published whole into one half of ppmFrame
+static uint16_t ppmPending[RC_CHANS];
+static volatile uint16_t ppmFrame[2][RC_CHANS];
+static volatile uint8_t ppmFrameBuffer = 0;     // half the ISR published last
+static uint8_t ppmReadBuffer = 0;               // half latched by pwmFrameComplete()
+static volatile ppmStats_t ppmStats;
+static uint32_t ppmIntervalAvgX16 = 0, ppmJitterAvgX16 = 0;
+
+// cost of the input capture interrupts in cpu cycles, for 'status' in the CLI
+static void isrCyclesUpdate(uint32_t cycles)
+{
+    isrCyclesAvgX16 += cycles - (isrCyclesAvgX16 >> 4);
+    if (cycles > isrCyclesMax)
+        isrCyclesMax = cycles;
+}
 
 void TIM2_IRQHandler(void)
 {
+    uint32_t start = cycleCount();
+
     if (usePPMFlag)
         ppmIRQHandler(TIM2);
     else
         pwmIRQHandler(TIM2);
+    isrCyclesUpdate(cycleCount() - start);
+}
+
+static void ppmFrameDone(uint8_t count, bool malformed)
+{
+    static bool lastFrameGood = false;
+    uint32_t now = micros();
+    uint32_t interval, deviation;
+    uint8_t buf, i;
+
+    ppmStats.channels = count;
+    if (malformed || count < PPM_MIN_CHANNELS) {
+        if (malformed)
+            ppmStats.malformedFrames++;
+        else
+            ppmStats.shortFrames++;
+        lastFrameGood = false;
+        return;
+    }
+
+    // fill the idle half, channels missing from this frame keep their last value
+    buf = ppmFrameBuffer ^ 1;
+    for (i = 0; i < RC_CHANS; i++)
+        ppmFrame[buf][i] = i < count ? ppmPending[i] : ppmFrame[ppmFrameBuffer][i];
+    ppmFrameBuffer = buf;
+    frameTime = now;
+    frameSeq++;
+
+    interval = now - ppmStats.frameTime;
+    ppmStats.frameTime = now;
+    ppmStats.frames++;
+
+    // interval statistics only between back to back good frames
+    if (lastFrameGood && interval < PPM_MAX_FRAME_INTERVAL) {
+        if (ppmIntervalAvgX16 == 0)
+            ppmIntervalAvgX16 = interval << 4;
+        ppmIntervalAvgX16 += interval - (ppmIntervalAvgX16 >> 4);
+        deviation = abs((int32_t)interval - (int32_t)(ppmIntervalAvgX16 >> 4));
+        ppmJitterAvgX16 += deviation - (ppmJitterAvgX16 >> 4);
+        ppmStats.intervalAvg = ppmIntervalAvgX16 >> 4;
+        ppmStats.jitterAvg = ppmJitterAvgX16 >> 4;
+        if (interval < ppmStats.intervalMin)
+            ppmStats.intervalMin = interval;
+        if (interval > ppmStats.intervalMax)
+            ppmStats.intervalMax = interval;
+    }
+    lastFrameGood = true;
 }
 
 static void ppmIRQHandler(TIM_TypeDef *tim)
@@ -64,6 +137,7 @@ static void ppmIRQHandler(TIM_TypeDef *tim)
     static uint16_t now;
     static uint16_t last = 0;
     static uint8_t chan = 0;
+    static bool malformed = false;
 
     if (TIM_GetITStatus(tim, TIM_IT_CC1) == SET) {
         last = now;
@@ -80,69 +154,60 @@ static void ppmIRQHandler(TIM_TypeDef *tim)
     }
 
     if (diff > 4000) {
+        // sync gap after at least one channel ends a frame
+        if (chan > 0)
+            ppmFrameDone(chan, malformed);
         chan = 0;
+        malformed = false;
     } else {
-        if (diff > 750 && diff < 2250 && chan < 8) {   // 750 to 2250 ms is our 'valid' channel range
-            Inputs[chan].capture = diff;
+        if (diff > 750 && diff < 2250) {   // 750 to 2250 ms is our 'valid' channel range
+            if (chan < RC_CHANS)
+                ppmPending[chan] = diff;
+        } else {
+            malformed = true;
         }
-        chan++;
+        if (chan < 0xff)
+            chan++;
     }
 }
 
 static void pwmIRQHandler(TIM_TypeDef *tim)
 {
     uint8_t i;
-    uint16_t val = 0;
+    uint16_t status, val;
 
-    for (i = 0; i < 8; i++) {
-        struct TIM_Channel channel = Channels[i];
-        struct PWM_State *state = &Inputs[i];
+    // service only the capture channels flagged in SR. writing 0 clears a flag, 1 leaves it alone
+    status = tim->SR & tim->DIER & (TIM_IT_CC1 | TIM_IT_CC2 | TIM_IT_CC3 | TIM_IT_CC4);
+    tim->SR = (uint16_t)~status;
 
-        if (channel.tim == tim && (TIM_GetITStatus(tim, channel.cc) == SET)) {
-            TIM_ClearITPendingBit(channel.tim, channel.cc);
-            if (i == 0)
-                rcActive = true;
-
-            switch (channel.channel) {
-                case TIM_Channel_1:
-                    val = TIM_GetCapture1(channel.tim);
-                    break;
-                case TIM_Channel_2:
-                    val = TIM_GetCapture2(channel.tim);
-                    break;
-                case TIM_Channel_3:
-                    val = TIM_GetCapture3(channel.tim);
-                    break;
-                case TIM_Channel_4:
-                    val = TIM_GetCapture4(channel.tim);
-                    break;
-            }
+    // CC1IF is bit 1, TIM2 holds inputs 0-3 and TIM3 inputs 4-7
+    status >>= 1;
+    for (i = (tim == TIM2) ? 0 : 4; status; i++, status >>= 1) {
+        const struct TIM_Channel *channel = &Channels[i];
+        struct PWM_State *state = &Inputs[i];
 
-            if (state->state == 0)
-                state->rise = val;
-            else
-                state->fall = val;
-
-            if (state->state == 0) {
-                // switch states
-                state->state = 1;
-
-                TIM_ICInitStructure.TIM_ICPolarity = TIM_ICPolarity_Falling;
-                TIM_ICInitStructure.TIM_Channel = channel.channel;
-                TIM_ICInit(channel.tim, &TIM_ICInitStructure);
-            } else {
-                // compute capture
-                if (state->fall > state->rise)
-                    state->capture = (state->fall - state->rise);
-                else
-                    state->capture = ((0xffff - state->rise) + state->fall);
-
-                // switch state
-                state->state = 0;
-
-                TIM_ICInitStructure.TIM_ICPolarity = TIM_ICPolarity_Rising;
-                TIM_ICInitStructure.TIM_Channel = channel.channel;
-                TIM_ICInit(channel.tim, &TIM_ICInitStructure);
+        if (!(status & 1))
+            continue;
+
+        val = *channel->ccr;
+        if (i == 0)
+            rcActive = true;
+
+        if (state->state == 0) {
+            state->rise = val;
+            state->state = 1;
+            // capture the falling edge next
+            tim->CCER |= channel->ccerPolarity;
+        } else {
+            state->fall = val;
+            // 16bit timer, unsigned wraparound takes care of overflow
+            state->capture = state->fall - state->rise;
+            state->state = 0;
+            tim->CCER &= ~channel->ccerPolarity;
+            // receivers update RX1 first, so its falling edge marks a new frame
+            if (i == 0) {
+                frameTime = micros();
+                frameSeq++;
             }
         }
     }
@@ -267,8 +332,12 @@ bool pwmInit(drv_pwm_config_t *init)
     usePPMFlag = init->usePPM;
 
     // preset channels to center    
-    for (i = 0; i < 8; i++)
+    for (i = 0; i < RC_CHANS; i++) {
         Inputs[i].capture = 1500;
+        ppmFrame[0][i] = 1500;
+        ppmFrame[1][i] = 1500;
+    }
+    ppmStats.intervalMin = 0xffff;
 
     // Timers run at 1mhz.
     // TODO: clean this shit up. Make it all dynamic etc.
@@ -323,11 +392,46 @@ void pwmWrite(uint8_t channel, uint16_t value)
         *OutputChannels[channel] = value;
 }
 
+// FY90Q motors stay on free running PWM, motorOneShot is ignored
+void pwmCompleteMotorUpdate(void)
+{
+}
+
 uint16_t pwmRead(uint8_t channel)
 {
+    if (usePPMFlag)
+        return ppmFrame[ppmReadBuffer][channel];
     return Inputs[channel].capture;
 }
 
+// also latches the PPM frame that pwmRead() returns until the next one
+bool pwmFrameComplete(void)
+{
+    uint16_t seq = frameSeq;
+
+    if (seq == frameSeqSeen)
+        return false;
+    frameSeqSeen = seq;
+    ppmReadBuffer = ppmFrameBuffer;
+    return true;
+}
+
+uint32_t pwmFrameTime(void)
+{
+    return frameTime;
+}
+
+void pwmGetPPMStats(ppmStats_t *stats)
+{
+    memcpy(stats, (void *)&ppmStats, sizeof(ppmStats_t));
+}
+
+void pwmGetISRCycles(uint32_t *avgCycles, uint32_t *maxCycles)
+{
+    *avgCycles = isrCyclesAvgX16 >> 4;
+    *maxCycles = isrCyclesMax;
+}
+
 uint8_t pwmGetNumOutputChannels(void)
 {
     return numOutputChannels;
@@ -30,6 +30,12 @@ static void cycleCounterInit(void)
     DWT_CTRL |= CYCCNTENA;
 }
 
+// raw CPU cycle count, for timing short code sections. wraps every ~60s at 72MHz
+uint32_t cycleCount(void)
+{
+    return *DWT_CYCCNT;
+}
+
 
 // SysTick
 void SysTick_Handler(void)
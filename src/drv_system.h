@@ -6,6 +6,7 @@ void delay(uint32_t ms);
 
 uint32_t micros(void);
 uint32_t millis(void);
+uint32_t cycleCount(void);
 
 // failure
 void failureMode(uint8_t mode);
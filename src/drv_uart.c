@@ -4,15 +4,30 @@
     DMA UART routines idea lifted from AutoQuad
     Copyright  2011  Bill Nesbitt
 */
-#define UART_BUFFER_SIZE    256
+// buffer sizes can be overridden from the build, both must be a power of two
+#ifndef UART_RX_BUFFER_SIZE
+#define UART_RX_BUFFER_SIZE 256
+#endif
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 512
+#endif
+#if (UART_RX_BUFFER_SIZE & (UART_RX_BUFFER_SIZE - 1)) || (UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1))
+#error "UART buffer sizes must be a power of two"
+#endif
+#define UART_RX_MASK        (UART_RX_BUFFER_SIZE - 1)
+#define UART_TX_MASK        (UART_TX_BUFFER_SIZE - 1)
 
 // Receive buffer, circular DMA
-volatile uint8_t rxBuffer[UART_BUFFER_SIZE];
+volatile uint8_t rxBuffer[UART_RX_BUFFER_SIZE];
 uint32_t rxDMAPos = 0;
 
-volatile uint8_t txBuffer[UART_BUFFER_SIZE];
-uint32_t txBufferTail = 0;
+// Transmit buffer. Bytes between txBufferTail and txBufferHead are queued, the CNDTR bytes before txBufferTail
+// are still being sent by DMA.
+volatile uint8_t txBuffer[UART_TX_BUFFER_SIZE];
+volatile uint32_t txBufferTail = 0;
 uint32_t txBufferHead = 0;
+static uint32_t txOverflows = 0;                // writes that found the buffer full and had to wait
+static uint32_t txDrops = 0;                    // bytes refused by uartWriteIfRoom()
 
 static void uartTxDMA(void)
 {
@@ -21,7 +36,7 @@ static void uartTxDMA(void)
         DMA1_Channel4->CNDTR = txBufferHead - txBufferTail;
         txBufferTail = txBufferHead;
     } else {
-        DMA1_Channel4->CNDTR = UART_BUFFER_SIZE - txBufferTail;
+        DMA1_Channel4->CNDTR = UART_TX_BUFFER_SIZE - txBufferTail;
         txBufferTail = 0;
     }
 
@@ -82,7 +97,7 @@ void uartInit(uint32_t speed)
     DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
     DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
     DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
-    DMA_InitStructure.DMA_BufferSize = UART_BUFFER_SIZE;
+    DMA_InitStructure.DMA_BufferSize = UART_RX_BUFFER_SIZE;
     DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
     DMA_Init(DMA1_Channel5, &DMA_InitStructure);
 
@@ -112,6 +127,35 @@ uint16_t uartAvailable(void)
     return (DMA_GetCurrDataCounter(DMA1_Channel5) != rxDMAPos) ? true : false;
 }
 
+// bytes received but not read yet. rxDMAPos and the DMA counter both count down from UART_RX_BUFFER_SIZE.
+uint16_t uartRxCount(void)
+{
+    return (rxDMAPos - DMA_GetCurrDataCounter(DMA1_Channel5)) & UART_RX_MASK;
+}
+
+// copy up to len received bytes into buf, returns the number copied
+uint16_t uartReadBuffer(uint8_t *buf, uint16_t len)
+{
+    uint16_t count = uartRxCount();
+    uint16_t tail = UART_RX_BUFFER_SIZE - rxDMAPos;
+    uint16_t chunk;
+
+    if (count > len)
+        count = len;
+    // the part up to the end of rxBuffer, then whatever wrapped around
+    chunk = UART_RX_BUFFER_SIZE - tail;
+    if (chunk > count)
+        chunk = count;
+
+    memcpy(buf, (uint8_t *)&rxBuffer[tail], chunk);
+    memcpy(buf + chunk, (uint8_t *)rxBuffer, count - chunk);
+    rxDMAPos -= count;
+    if (rxDMAPos == 0 || rxDMAPos > UART_RX_BUFFER_SIZE)
+        rxDMAPos += UART_RX_BUFFER_SIZE;
+
+    return count;
+}
+
 bool uartTransmitEmpty(void)
 {
     return (txBufferTail == txBufferHead);
@@ -121,10 +165,10 @@ uint8_t uartRead(void)
 {
     uint8_t ch;
 
-    ch = rxBuffer[UART_BUFFER_SIZE - rxDMAPos];
+    ch = rxBuffer[UART_RX_BUFFER_SIZE - rxDMAPos];
     // go back around the buffer
     if (--rxDMAPos == 0)
-        rxDMAPos = UART_BUFFER_SIZE;
+        rxDMAPos = UART_RX_BUFFER_SIZE;
 
     return ch;
 }
@@ -135,16 +179,76 @@ uint8_t uartReadPoll(void)
     return uartRead();
 }
 
+// room left in txBuffer. tail is read before the DMA count, so a transfer restarted by the
+// interrupt in between can only make this come out smaller than it is.
+uint16_t uartTxFree(void)
+{
+    uint32_t tail = txBufferTail;
+    uint32_t used = ((txBufferHead - tail) & UART_TX_MASK) + DMA1_Channel4->CNDTR;
+
+    if (used >= UART_TX_BUFFER_SIZE - 1)
+        return 0;
+    return UART_TX_BUFFER_SIZE - 1 - used;
+}
+
+// when the buffer is full, wait for the DMA to make room instead of overwriting unsent data
+static void uartWaitTxFree(void)
+{
+    if (uartTxFree())
+        return;
+    txOverflows++;
+    while (!uartTxFree());
+}
+
 void uartWrite(uint8_t ch)
 {
+    uartWaitTxFree();
     txBuffer[txBufferHead] = ch;
-    txBufferHead = (txBufferHead + 1) % UART_BUFFER_SIZE;
+    txBufferHead = (txBufferHead + 1) & UART_TX_MASK;
 
     // if DMA wasn't enabled, fire it up
     if (!(DMA1_Channel4->CCR & 1))
         uartTxDMA();
 }
 
+void uartWriteBuffer(const uint8_t *buf, uint16_t len)
+{
+    uint16_t chunk;
+
+    while (len) {
+        uartWaitTxFree();
+        chunk = uartTxFree();
+        if (chunk > len)
+            chunk = len;
+        if (chunk > UART_TX_BUFFER_SIZE - txBufferHead)
+            chunk = UART_TX_BUFFER_SIZE - txBufferHead;
+        memcpy((uint8_t *)&txBuffer[txBufferHead], buf, chunk);
+        txBufferHead = (txBufferHead + chunk) & UART_TX_MASK;
+        buf += chunk;
+        len -= chunk;
+
+        if (!(DMA1_Channel4->CCR & 1))
+            uartTxDMA();
+    }
+}
+
+// all or nothing, never waits. For output that is better dropped than delayed, like telemetry.
+bool uartWriteIfRoom(const uint8_t *buf, uint16_t len)
+{
+    if (uartTxFree() < len) {
+        txDrops += len;
+        return false;
+    }
+    uartWriteBuffer(buf, len);
+    return true;
+}
+
+void uartGetTxStats(uint32_t *overflows, uint32_t *drops)
+{
+    *overflows = txOverflows;
+    *drops = txDrops;
+}
+
 void uartPrint(char *str)
 {
     while (*str)
@@ -152,13 +256,30 @@ void uartPrint(char *str)
 }
 
 /* -------------------------- UART2 (Spektrum, GPS) ----------------------------- */
+// Receive runs on circular DMA (DMA1 channel 6), there is no interrupt per byte. The idle line interrupt records
+// where and when a burst of bytes ended, the DMA half/full interrupts count how far the DMA got. uart2Process()
+// hands the data to the parser from the main loop, split at the idle position so frame based receivers get their
+// framing and timing from it.
+#define UART2_RX_BUFFER_SIZE    512     // power of two, holds 44ms at 115200. A ~20ms flash erase loses nothing, longer stalls count as overruns.
+#define UART2_RX_MASK           (UART2_RX_BUFFER_SIZE - 1)
+#define UART2_RX_HALF           (UART2_RX_BUFFER_SIZE / 2)
+
+static volatile uint8_t rx2Buffer[UART2_RX_BUFFER_SIZE];
+static volatile uint32_t rx2Halves = 0;         // buffer halves the DMA has filled
+static uint32_t rx2ReadCount = 0;               // bytes handed to the parser, counts on like the DMA total
+static uint32_t rx2Overruns = 0;                // times the DMA lapped the parser and unread data was dropped
+static volatile uint32_t rx2IdlePos = 0;        // DMA write position when the line last went idle
+static volatile uint32_t rx2IdleTime = 0;
+static volatile uint16_t rx2IdleSeq = 0;
+static uint16_t rx2IdleSeqSeen = 0;
 uartReceiveCallbackPtr uart2Callback = NULL;
 
-void uart2Init(uint32_t speed, uartReceiveCallbackPtr func)
+void uart2Init(uint32_t speed, uartReceiveCallbackPtr func, uartFraming_e framing)
 {
     NVIC_InitTypeDef NVIC_InitStructure;
     GPIO_InitTypeDef GPIO_InitStructure;
     USART_InitTypeDef USART_InitStructure;
+    DMA_InitTypeDef DMA_InitStructure;
 
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_USART2, ENABLE);
 
@@ -167,28 +288,158 @@ void uart2Init(uint32_t speed, uartReceiveCallbackPtr func)
     NVIC_InitStructure.NVIC_IRQChannelSubPriority = 2;
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init(&NVIC_InitStructure);
+    NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel6_IRQn;
+    NVIC_Init(&NVIC_InitStructure);
 
     GPIO_InitStructure.GPIO_Pin = GPIO_Pin_3;
     GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IN_FLOATING;
     GPIO_Init(GPIOA, &GPIO_InitStructure);
 
     USART_InitStructure.USART_BaudRate = speed;
-    USART_InitStructure.USART_WordLength = USART_WordLength_8b;
-    USART_InitStructure.USART_StopBits = USART_StopBits_1;
-    USART_InitStructure.USART_Parity = USART_Parity_No;
+    if (framing == UART_8E2) {
+        // word length includes the parity bit
+        USART_InitStructure.USART_WordLength = USART_WordLength_9b;
+        USART_InitStructure.USART_StopBits = USART_StopBits_2;
+        USART_InitStructure.USART_Parity = USART_Parity_Even;
+    } else {
+        USART_InitStructure.USART_WordLength = USART_WordLength_8b;
+        USART_InitStructure.USART_StopBits = USART_StopBits_1;
+        USART_InitStructure.USART_Parity = USART_Parity_No;
+    }
     USART_InitStructure.USART_Mode = USART_Mode_Rx;
     USART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
     USART_Init(USART2, &USART_InitStructure);
 
-    USART_ITConfig(USART2, USART_IT_RXNE, ENABLE);
-    USART_Cmd(USART2, ENABLE);
+    // Receive DMA into a circular buffer. With parity enabled the DMA takes the low 8 bits, that's the data byte.
+    DMA_DeInit(DMA1_Channel6);
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&USART2->DR;
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)rx2Buffer;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+    DMA_InitStructure.DMA_BufferSize = UART2_RX_BUFFER_SIZE;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_Medium;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_Init(DMA1_Channel6, &DMA_InitStructure);
+    DMA_ITConfig(DMA1_Channel6, DMA_IT_HT | DMA_IT_TC, ENABLE);
+    rx2Halves = 0;
+    rx2ReadCount = 0;
+    DMA_Cmd(DMA1_Channel6, ENABLE);
+    USART_DMACmd(USART2, USART_DMAReq_Rx, ENABLE);
+
     uart2Callback = func;
+    USART_ITConfig(USART2, USART_IT_IDLE, ENABLE);
+    USART_Cmd(USART2, ENABLE);
 }
 
 void USART2_IRQHandler(void)
 {
-    if (USART_GetITStatus(USART2, USART_IT_RXNE) == SET) {
-        if (uart2Callback)
-            uart2Callback(USART_ReceiveData(USART2));
+    if (USART_GetITStatus(USART2, USART_IT_IDLE) == SET) {
+        // SR was read above, reading DR clears the flag. The DMA already took the data.
+        (void)USART2->DR;
+        rx2IdlePos = (UART2_RX_BUFFER_SIZE - DMA1_Channel6->CNDTR) & UART2_RX_MASK;
+        rx2IdleTime = micros();
+        rx2IdleSeq++;
+    }
+}
+
+#define UART2_RX_DMA_FLAGS      (DMA1_FLAG_HT6 | DMA1_FLAG_TC6)
+
+// half buffer boundaries passed, from the HT/TC flags. After a stall of more than half a buffer both are set.
+static uint32_t uart2HalvesFromFlags(uint32_t flags)
+{
+    return ((flags & DMA1_FLAG_HT6) ? 1 : 0) + ((flags & DMA1_FLAG_TC6) ? 1 : 0);
+}
+
+void DMA1_Channel6_IRQHandler(void)
+{
+    uint32_t flags = DMA1->ISR & UART2_RX_DMA_FLAGS;
+
+    // clear only what is counted, a flag set after the read stays pending for the next interrupt
+    DMA1->IFCR = flags;
+    rx2Halves += uart2HalvesFromFlags(flags);
+}
+
+// bytes the DMA has written since init. Boundaries the interrupt hasn't counted yet are still pending in the flags,
+// those are read together with the position so both describe the same moment.
+static uint32_t uart2WriteCount(void)
+{
+    uint32_t halves, flags, pos;
+
+    __disable_irq();
+    do {
+        flags = DMA1->ISR & UART2_RX_DMA_FLAGS;
+        pos = UART2_RX_BUFFER_SIZE - DMA1_Channel6->CNDTR;
+    } while (flags != (DMA1->ISR & UART2_RX_DMA_FLAGS));
+    halves = rx2Halves + uart2HalvesFromFlags(flags);
+    // a stall of a whole buffer sets a flag twice and loses a half, the half the DMA is in shows it
+    if ((halves & 1) != pos / UART2_RX_HALF) {
+        rx2Halves++;
+        halves++;
     }
+    __enable_irq();
+
+    return halves * UART2_RX_HALF + (pos & (UART2_RX_HALF - 1));
+}
+
+// bytes up to end go to the parser straight out of the DMA buffer, in at most two pieces
+static void uart2Deliver(uint32_t end, uint32_t idleTime)
+{
+    uint32_t readPos = rx2ReadCount & UART2_RX_MASK;
+    uint32_t len = (end - readPos) & UART2_RX_MASK;
+    uint32_t chunk = UART2_RX_BUFFER_SIZE - readPos;
+
+    if (!len && !idleTime)
+        return;
+
+    if (chunk < len) {
+        uart2Callback((const uint8_t *)&rx2Buffer[readPos], chunk, 0);
+        uart2Callback((const uint8_t *)rx2Buffer, len - chunk, idleTime);
+    } else {
+        uart2Callback((const uint8_t *)&rx2Buffer[readPos], len, idleTime);
+    }
+    rx2ReadCount += len;
+}
+
+void uart2Process(void)
+{
+    uint32_t writeCount, writePos, readPos, idlePos, idleTime;
+    uint16_t seq;
+
+    if (!uart2Callback)
+        return;
+
+    __disable_irq();
+    seq = rx2IdleSeq;
+    idlePos = rx2IdlePos;
+    idleTime = rx2IdleTime;
+    __enable_irq();
+    // taken after the idle position, so that one is never ahead of it
+    writeCount = uart2WriteCount();
+    writePos = writeCount & UART2_RX_MASK;
+
+    if (writeCount - rx2ReadCount >= UART2_RX_BUFFER_SIZE) {
+        // the DMA caught up with unread data, drop all of it. The frame parsers reject the bursts that got cut.
+        rx2Overruns++;
+        rx2ReadCount = writeCount;
+        rx2IdleSeqSeen = seq;
+        return;
+    }
+
+    readPos = rx2ReadCount & UART2_RX_MASK;
+    if (seq != rx2IdleSeqSeen) {
+        rx2IdleSeqSeen = seq;
+        // an idle that fired just after the last call had already read past it is stale, skip it
+        if (((idlePos - readPos) & UART2_RX_MASK) <= ((writePos - readPos) & UART2_RX_MASK))
+            uart2Deliver(idlePos, idleTime);
+    }
+    uart2Deliver(writePos, 0);
+}
+
+uint32_t uart2GetOverruns(void)
+{
+    return rx2Overruns;
 }
@@ -1,10 +1,23 @@
 #pragma once
 
+typedef enum {
+    UART_8N1 = 0,
+    UART_8E2,                   // SBUS
+} uartFraming_e;
+
 void uartInit(uint32_t speed);
 uint16_t uartAvailable(void);
+uint16_t uartRxCount(void);
+uint16_t uartReadBuffer(uint8_t *buf, uint16_t len);
 bool uartTransmitEmpty(void);
 uint8_t uartRead(void);
 uint8_t uartReadPoll(void);
+uint16_t uartTxFree(void);
 void uartWrite(uint8_t ch);
+void uartWriteBuffer(const uint8_t *buf, uint16_t len);
+bool uartWriteIfRoom(const uint8_t *buf, uint16_t len);
+void uartGetTxStats(uint32_t *overflows, uint32_t *drops);
 void uartPrint(char *str);
-void uart2Init(uint32_t speed, uartReceiveCallbackPtr func);
+void uart2Init(uint32_t speed, uartReceiveCallbackPtr func, uartFraming_e framing);
+void uart2Process(void);
+uint32_t uart2GetOverruns(void);
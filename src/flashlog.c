@@ -0,0 +1,190 @@
+#include "board.h"
+#include "mw.h"
+
+// Flight log in flash
+// Events and a summary of each flight are appended to a ring of FLASHLOG_PAGES pages just below the config page.
+// Each record carries a sequence number, so the newest one is found again after a reboot. Pages are erased only
+// when the ring moves into them, so every page sees the same number of erase cycles.
+// Nothing touches flash while armed: records wait in RAM and go out in one batch after disarming,
+// an erase stalls the cpu for ~20ms.
+
+#define FLASHLOG_PAGES          4
+#define FLASHLOG_ADDR           (0x08000000 + (uint32_t)FLASH_PAGE_SIZE * (FLASH_PAGE_COUNT - 1 - FLASHLOG_PAGES))
+#define FLASHLOG_RECORDS        (FLASHLOG_PAGES * FLASH_PAGE_SIZE / sizeof(flashLogRecord_t))
+#define FLASHLOG_PAGE_RECORDS   (FLASH_PAGE_SIZE / sizeof(flashLogRecord_t))
+#define FLASHLOG_QUEUE_SIZE     8
+#define FLASHLOG_OVERRUN_US     5000    // cycleTime above this counts as a loop overrun
+
+static flashLogRecord_t queue[FLASHLOG_QUEUE_SIZE];
+static uint8_t queueCount = 0;
+static uint16_t nextSeq = 0;
+static uint16_t head = 0;                   // next record slot in the ring
+static uint32_t lostRecords = 0;
+
+// per flight statistics for the disarm summary
+static bool wasArmed = false;
+static bool failsafeLogged, i2cErrorLogged;
+static uint32_t armTime;
+static uint16_t maxCycleTime;
+static uint16_t loopOverruns;
+static uint8_t minVbat;
+static uint16_t i2cErrorsAtArm;
+static int16_t failsafeEventsAtArm;
+
+// from mw.c
+extern int16_t failsafeEvents;
+
+static const flashLogRecord_t *flashLogSlot(uint16_t index)
+{
+    return (const flashLogRecord_t *)FLASHLOG_ADDR + index;
+}
+
+void flashLogInit(void)
+{
+    const flashLogRecord_t *rec;
+    bool found = false;
+    uint16_t i, newest = 0;
+
+    // the newest record is the one with the highest sequence number, with wraparound
+    for (i = 0; i < FLASHLOG_RECORDS; i++) {
+        rec = flashLogSlot(i);
+        if (rec->type == FLASHLOG_BLANK)
+            continue;
+        if (!found || (int16_t)(rec->seq - flashLogSlot(newest)->seq) > 0)
+            newest = i;
+        found = true;
+    }
+
+    if (found) {
+        head = (newest + 1) % FLASHLOG_RECORDS;
+        nextSeq = flashLogSlot(newest)->seq + 1;
+    }
+
+    flashLogEvent(FLASHLOG_BOOT, 0, cfg.version, 0);
+}
+
+// queue a record for the next batch, never blocks
+void flashLogEvent(uint8_t type, uint8_t param, uint32_t data0, uint32_t data1)
+{
+    flashLogRecord_t *rec;
+
+    if (queueCount == FLASHLOG_QUEUE_SIZE) {
+        lostRecords++;
+        return;
+    }
+
+    rec = &queue[queueCount++];
+    rec->type = type;
+    rec->param = param;
+    rec->seq = nextSeq++;
+    rec->time = millis();
+    rec->data[0] = data0;
+    rec->data[1] = data1;
+}
+
+static void flashLogFlush(void)
+{
+    uint32_t addr;
+    uint8_t i, j;
+
+    FLASH_Unlock();
+    FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_PGERR | FLASH_FLAG_WRPRTERR);
+
+    for (i = 0; i < queueCount; i++) {
+        // a slot that isn't blank (write cut by a reset) skips to the next page
+        if (head % FLASHLOG_PAGE_RECORDS && *(uint32_t *)flashLogSlot(head) != 0xFFFFFFFF)
+            head = (head - head % FLASHLOG_PAGE_RECORDS + FLASHLOG_PAGE_RECORDS) % FLASHLOG_RECORDS;
+        // entering a page, erase it. It holds the oldest records of the ring.
+        if (head % FLASHLOG_PAGE_RECORDS == 0 && FLASH_ErasePage((uint32_t)flashLogSlot(head)) != FLASH_COMPLETE)
+            break;
+
+        addr = (uint32_t)flashLogSlot(head);
+        for (j = 0; j < sizeof(flashLogRecord_t); j += 4) {
+            if (FLASH_ProgramWord(addr + j, *(uint32_t *)((char *)&queue[i] + j)) != FLASH_COMPLETE)
+                break;
+        }
+        head = (head + 1) % FLASHLOG_RECORDS;
+    }
+
+    FLASH_Lock();
+    lostRecords += queueCount - i;
+    queueCount = 0;
+}
+
+// once per loop. Tracks the flight statistics while armed, writes queued records once disarmed.
+void flashLogUpdate(void)
+{
+    uint16_t i2cErrors;
+
+    if (armed) {
+        if (!wasArmed) {
+            wasArmed = true;
+            failsafeLogged = false;
+            i2cErrorLogged = false;
+            armTime = millis();
+            maxCycleTime = 0;
+            loopOverruns = 0;
+            minVbat = vbat;
+            i2cErrorsAtArm = i2cGetErrorCounter();
+            failsafeEventsAtArm = failsafeEvents;
+            flashLogEvent(FLASHLOG_ARM, 0, vbat, 0);
+            return;
+        }
+
+        if (cycleTime > maxCycleTime)
+            maxCycleTime = cycleTime;
+        if (cycleTime > FLASHLOG_OVERRUN_US && loopOverruns++ == 0)
+            flashLogEvent(FLASHLOG_LOOP_OVERRUN, 0, cycleTime, 0);
+        if (vbat && vbat < minVbat)
+            minVbat = vbat;
+        // first occurrence in a flight only, the totals are in the summary
+        if (failsafeEvents != failsafeEventsAtArm && !failsafeLogged) {
+            failsafeLogged = true;
+            flashLogEvent(FLASHLOG_FAILSAFE, 0, failsafeEvents - failsafeEventsAtArm, 0);
+        }
+        if (i2cGetErrorCounter() != i2cErrorsAtArm && !i2cErrorLogged) {
+            i2cErrorLogged = true;
+            flashLogEvent(FLASHLOG_I2C_ERROR, 0, i2cGetErrorCounter() - i2cErrorsAtArm, 0);
+        }
+        return;
+    }
+
+    if (wasArmed) {
+        wasArmed = false;
+        i2cErrors = i2cGetErrorCounter() - i2cErrorsAtArm;
+        flashLogEvent(FLASHLOG_DISARM, min(failsafeEvents - failsafeEventsAtArm, 255),
+            min((millis() - armTime) / 1000, 0xFFFF) | (uint32_t)maxCycleTime << 16,
+            minVbat | min(i2cErrors, 255) << 8 | (uint32_t)loopOverruns << 16);
+    }
+
+    if (queueCount)
+        flashLogFlush();
+}
+
+// oldest first, returns false past the end
+bool flashLogRead(uint16_t index, flashLogRecord_t *rec)
+{
+    uint16_t slot = (head + index) % FLASHLOG_RECORDS;
+
+    if (index >= FLASHLOG_RECORDS)
+        return false;
+    memcpy(rec, flashLogSlot(slot), sizeof(flashLogRecord_t));
+    return true;
+}
+
+void flashLogErase(void)
+{
+    uint8_t i;
+
+    FLASH_Unlock();
+    FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_PGERR | FLASH_FLAG_WRPRTERR);
+    for (i = 0; i < FLASHLOG_PAGES; i++)
+        FLASH_ErasePage(FLASHLOG_ADDR + (uint32_t)FLASH_PAGE_SIZE * i);
+    FLASH_Lock();
+    head = 0;
+}
+
+uint32_t flashLogLostRecords(void)
+{
+    return lostRecords;
+}
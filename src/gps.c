@@ -5,13 +5,14 @@
 #define sq(x) ((x)*(x))
 #endif
 
+static void GPS_DataReceive(const uint8_t *data, uint16_t len, uint32_t idleTime);
 static void GPS_NewData(uint16_t c);
 static bool GPS_newFrame(char c);
 static void GPS_distance(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2, uint16_t * dist, int16_t * bearing);
 
 void gpsInit(uint32_t baudrate)
 {
-    uart2Init(baudrate, GPS_NewData);
+    uart2Init(baudrate, GPS_DataReceive, UART_8N1);
     sensorsSet(SENSOR_GPS);
 }
 
@@ -21,6 +22,13 @@ void gpsInit(uint32_t baudrate)
  *
  *-----------------------------------------------------------*/
 
+// UART2 receive callback, from uart2Process(). NMEA has its own framing, so line idle doesn't matter.
+static void GPS_DataReceive(const uint8_t *data, uint16_t len, uint32_t idleTime)
+{
+    while (len--)
+        GPS_NewData(*data++);
+}
+
 static void GPS_NewData(uint16_t c)
 {
     if (GPS_newFrame(c)) {
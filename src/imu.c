@@ -5,6 +5,7 @@ int16_t gyroADC[3], accADC[3], accSmooth[3], magADC[3];
 int16_t acc_25deg = 0;
 int32_t  BaroAlt;
 int32_t  EstAlt;             // in cm
+int16_t  zVelocity;          // in cm/s, positive up
 int16_t  BaroPID = 0;
 int32_t  AltHold;
 int16_t  errorAltitudeI = 0;
@@ -16,6 +17,10 @@ int16_t gyroData[3] = { 0, 0, 0 };
 int16_t gyroZero[3] = { 0, 0, 0 };
 int16_t angle[2] = { 0, 0 };     // absolute angle inclination in multiple of 0.1 degree    180 deg = 1800
 int8_t smallAngle25 = 1;
+uint32_t imuAccUpdates = 0, imuAccSkips = 0;  // estimator stages run vs. skipped for lack of new data
+uint32_t imuMagUpdates = 0, imuMagSkips = 0;
+static int32_t accZSum = 0;     // earth frame vertical acceleration, accumulated for getEstimatedAltitude()
+static uint16_t accZSamples = 0;
 
 static void getEstimatedAttitude(void);
 
@@ -23,6 +28,9 @@ void imuInit(void)
 {
     acc_25deg = acc_1G * 0.423f;
 
+    if (feature(FEATURE_DYNAMIC_NOTCH))
+        dynNotchInit();
+
 #ifdef MAG
     // if mag sensor is enabled, use it
     if (sensors(SENSOR_MAG))
@@ -38,9 +46,14 @@ void computeIMU(void)
     int16_t gyroADCinter[3];
     static uint32_t timeInterleave = 0;
     static int16_t gyroYawSmooth = 0;
+    static uint8_t accDivider = 0;
 
     if (sensors(SENSOR_ACC)) {
-        ACC_getADC();
+        // acc correction only needs tens of Hz, save the I2C transfer on the other cycles
+        if (++accDivider >= cfg.acc_sample_div) {
+            accDivider = 0;
+            ACC_getADC();
+        }
         getEstimatedAttitude();
     }
 
@@ -67,6 +80,9 @@ void computeIMU(void)
             accADC[axis] = 0;
     }
 
+    if (feature(FEATURE_DYNAMIC_NOTCH))
+        dynNotchUpdate();
+
     if (feature(FEATURE_GYRO_SMOOTHING)) {
         static uint8_t Smoothing[3] = { 0, 0, 0 };
         static int16_t gyroSmooth[3] = { 0, 0, 0 };
@@ -118,16 +134,19 @@ void computeIMU(void)
 /* Set the Gyro Weight for Gyro/Acc complementary filter */
 /* Increasing this value would reduce and delay Acc influence on the output of the filter*/
 /* Default WMC value: 300*/
+/* Weight per loop cycle, divided by the loops per acc sample since the blend only runs on a new sample (ADXL345 is 100Hz) */
 #define GYR_CMPF_FACTOR 310.0f
 
 /* Set the Gyro Weight for Gyro/Magnetometer complementary filter */
 /* Increasing this value would reduce and delay Magnetometer influence on the output of the filter*/
-/* Default WMC value: n/a*/
-#define GYR_CMPFM_FACTOR 200.0f
+/* Applied once per mag sample (10Hz), 4 is about the same response as 200 applied every 2ms cycle */
+#define GYR_CMPFM_FACTOR 4.0f
+
+/* Largest gyro rotation (rad) collected between mag samples before EstM is rotated anyway */
+#define MAG_DEFER_ANGLE_MAX 0.05f
 
 //****** end of advanced users settings *************
 
-#define INV_GYR_CMPF_FACTOR   (1.0f / (GYR_CMPF_FACTOR  + 1.0f))
 #define INV_GYR_CMPFM_FACTOR  (1.0f / (GYR_CMPFM_FACTOR + 1.0f))
 
 #define GYRO_SCALE ((1998 * M_PI)/((32767.0f / 4.0f ) * 180.0f * 1000000.0f))     // 32767 / 16.4lsb/dps for MPU3000
@@ -170,65 +189,83 @@ static void getEstimatedAttitude(void)
     uint8_t axis;
     int32_t accMag = 0;
     static t_fp_vector EstG;
+#ifdef MAG
     static t_fp_vector EstM;
 #if defined(MG_LPF_FACTOR)
     static int16_t mgSmooth[3];
+#endif
+    static float magDeltaAngle[3];  // gyro rotation not yet applied to EstM
+    static uint16_t magSeq;
 #endif
     static float accTemp[3];  // projection of smoothed and normalized magnetic vector on x/y/z axis, as measured by magnetometer
+    static uint16_t accSeq;
+    static uint8_t accLoops = 0;    // loop cycles since the last acc sample
     static uint32_t previousT;
     uint32_t currentT = micros();
     float scale, deltaGyroAngle[3];
+    float cmpfFactor, invCmpfFactor, lpfKeep = 0.0f;
 
     scale = (currentT - previousT) * GYRO_SCALE;
     previousT = currentT;
 
-    // Initialization
-    for (axis = 0; axis < 3; axis++) {
+    // Gyro propagation runs every cycle
+    for (axis = 0; axis < 3; axis++)
         deltaGyroAngle[axis] = gyroADC[axis] * scale;
-        if (cfg.acc_lpf_factor > 0) {
-            accTemp[axis] = accTemp[axis] * (1.0f - (1.0f / cfg.acc_lpf_factor)) + accADC[axis] * (1.0f / cfg.acc_lpf_factor);
-            accSmooth[axis] = roundf(accTemp[axis]);
-            // accTemp[axis] = (accTemp[axis] - (accTemp[axis] >> cfg.acc_lpf_factor)) + accADC[axis];
-            // accSmooth[axis] = accTemp[axis] >> cfg.acc_lpf_factor;
-        } else {
-            accSmooth[axis] = accADC[axis];
-        }
-        accMag += (int32_t)accSmooth[axis] * accSmooth[axis];
-
-        if (sensors(SENSOR_MAG)) {
-#if defined(MG_LPF_FACTOR)
-            mgSmooth[axis] = (mgSmooth[axis] * (MG_LPF_FACTOR - 1) + magADC[axis]) / MG_LPF_FACTOR; // LPF for Magnetometer values
-#define MAG_VALUE mgSmooth[axis]
-#else
-#define MAG_VALUE magADC[axis]
-#endif
-        }
-    }
-    accMag = accMag * 100 / ((int32_t)acc_1G * acc_1G);
-
     rotateV(&EstG.V, deltaGyroAngle);
-    if (sensors(SENSOR_MAG)) {
-        rotateV(&EstM.V, deltaGyroAngle);
-    }
-
-    if (abs(accSmooth[ROLL]) < acc_25deg && abs(accSmooth[PITCH]) < acc_25deg && accSmooth[YAW] > 0)
-        smallAngle25 = 1;
-    else
-        smallAngle25 = 0;
+    if (accLoops < 255)
+        accLoops++;
+
+    // ACC stage only runs when the sensor delivered a new sample
+    if (accSampleSeq != accSeq) {
+        accSeq = accSampleSeq;
+        imuAccUpdates++;
+        // keep the filter time constants independent of the acc sample rate. With acc_sample_div = N
+        // and a sensor that has a fresh sample on every read, accLoops is N.
+        cmpfFactor = GYR_CMPF_FACTOR / accLoops;
+        invCmpfFactor = 1.0f / (cmpfFactor + 1.0f);
+        // the LPF factor is small, so apply it exactly as accLoops per-loop steps would
+        if (cfg.acc_lpf_factor > 0)
+            lpfKeep = powf(1.0f - (1.0f / cfg.acc_lpf_factor), accLoops);
+        accLoops = 0;
 
-    // Apply complimentary filter (Gyro drift correction)
-    // If accel magnitude >1.4G or <0.6G and ACC vector outside of the limit range => we neutralize the effect of accelerometers in the angle estimation.
-    // To do that, we just skip filter, as EstV already rotated by Gyro
-    if ((36 < accMag && accMag < 196) || smallAngle25) {
         for (axis = 0; axis < 3; axis++) {
-            // int16_t acc = accSmooth[axis];
-            EstG.A[axis] = (EstG.A[axis] * GYR_CMPF_FACTOR + accTemp[axis]) * INV_GYR_CMPF_FACTOR;
+            if (cfg.acc_lpf_factor > 0) {
+                accTemp[axis] = accTemp[axis] * lpfKeep + accADC[axis] * (1.0f - lpfKeep);
+                accSmooth[axis] = roundf(accTemp[axis]);
+                // accTemp[axis] = (accTemp[axis] - (accTemp[axis] >> cfg.acc_lpf_factor)) + accADC[axis];
+                // accSmooth[axis] = accTemp[axis] >> cfg.acc_lpf_factor;
+            } else {
+                accSmooth[axis] = accADC[axis];
+            }
+            accMag += (int32_t)accSmooth[axis] * accSmooth[axis];
+        }
+        accMag = accMag * 100 / ((int32_t)acc_1G * acc_1G);
+
+        if (abs(accSmooth[ROLL]) < acc_25deg && abs(accSmooth[PITCH]) < acc_25deg && accSmooth[YAW] > 0)
+            smallAngle25 = 1;
+        else
+            smallAngle25 = 0;
+
+        // Apply complimentary filter (Gyro drift correction)
+        // If accel magnitude >1.4G or <0.6G and ACC vector outside of the limit range => we neutralize the effect of accelerometers in the angle estimation.
+        // To do that, we just skip filter, as EstV already rotated by Gyro
+        if ((36 < accMag && accMag < 196) || smallAngle25) {
+            for (axis = 0; axis < 3; axis++) {
+                // int16_t acc = accSmooth[axis];
+                EstG.A[axis] = (EstG.A[axis] * cmpfFactor + accTemp[axis]) * invCmpfFactor;
+            }
         }
-    }
 
-    if (sensors(SENSOR_MAG)) {
-        for (axis = 0; axis < 3; axis++)
-            EstM.A[axis] = (EstM.A[axis] * GYR_CMPFM_FACTOR + MAG_VALUE) * INV_GYR_CMPFM_FACTOR;
+#if defined(BARO) && defined(TRUSTED_ACCZ)
+        if (sensors(SENSOR_BARO)) {
+            // project acceleration onto the estimated gravity vector to get earth frame Z, minus 1G
+            float invG = 1.0f / sqrtf(EstG.V.X * EstG.V.X + EstG.V.Y * EstG.V.Y + EstG.V.Z * EstG.V.Z);
+            accZSum += (accSmooth[ROLL] * EstG.V.X + accSmooth[PITCH] * EstG.V.Y + accSmooth[YAW] * EstG.V.Z) * invG - acc_1G;
+            accZSamples++;
+        }
+#endif
+    } else {
+        imuAccSkips++;
     }
 
     // Attitude of the estimated vector
@@ -237,8 +274,35 @@ static void getEstimatedAttitude(void)
 
 #ifdef MAG
     if (sensors(SENSOR_MAG)) {
-        // Attitude of the cross product vector GxM
-        heading = _atan2f(EstG.V.X * EstM.V.Z - EstG.V.Z * EstM.V.X, EstG.V.Z * EstM.V.Y - EstG.V.Y * EstM.V.Z) / 10;
+        // Mag only updates at 10Hz. Collect the gyro rotation and apply it to EstM in one go when a sample
+        // arrives, or earlier if the collected angle gets too big for the small angle approximation.
+        bool magNew = magSampleSeq != magSeq;
+        for (axis = 0; axis < 3; axis++)
+            magDeltaAngle[axis] += deltaGyroAngle[axis];
+
+        if (magNew || fabsf(magDeltaAngle[ROLL]) > MAG_DEFER_ANGLE_MAX || fabsf(magDeltaAngle[PITCH]) > MAG_DEFER_ANGLE_MAX || fabsf(magDeltaAngle[YAW]) > MAG_DEFER_ANGLE_MAX) {
+            rotateV(&EstM.V, magDeltaAngle);
+            magDeltaAngle[ROLL] = magDeltaAngle[PITCH] = magDeltaAngle[YAW] = 0.0f;
+
+            if (magNew) {
+                magSeq = magSampleSeq;
+                for (axis = 0; axis < 3; axis++) {
+#if defined(MG_LPF_FACTOR)
+                    mgSmooth[axis] = (mgSmooth[axis] * (MG_LPF_FACTOR - 1) + magADC[axis]) / MG_LPF_FACTOR; // LPF for Magnetometer values
+#define MAG_VALUE mgSmooth[axis]
+#else
+#define MAG_VALUE magADC[axis]
+#endif
+                    EstM.A[axis] = (EstM.A[axis] * GYR_CMPFM_FACTOR + MAG_VALUE) * INV_GYR_CMPFM_FACTOR;
+                }
+            }
+
+            // Attitude of the cross product vector GxM
+            heading = _atan2f(EstG.V.X * EstM.V.Z - EstG.V.Z * EstM.V.X, EstG.V.Z * EstM.V.Y - EstG.V.Y * EstM.V.Z) / 10;
+            imuMagUpdates++;
+        } else {
+            imuMagSkips++;
+        }
     }
 #endif
 }
@@ -246,43 +310,69 @@ static void getEstimatedAttitude(void)
 #ifdef BARO
 #define UPDATE_INTERVAL 25000   // 40hz update rate (20hz LPF on acc)
 #define INIT_DELAY      4000000 // 4 sec initialization delay
-#define BARO_TAB_SIZE   40
+
+// Third order complementary filter of baro altitude and earth frame acc Z, time constant of 3s.
+// Gains are K1 = 3/tau, K2 = 3/tau^2, K3 = 1/tau^3 in Q8. Altitude, velocity and acceleration are kept in Q8 (cm, cm/s, cm/s^2).
+#define ALT_CF_K1       256
+#define ALT_CF_K2       85
+#define ALT_CF_K3       9
+
+// a * dt where dt is seconds in Q16
+static int32_t mulDt(int32_t a, uint32_t dtQ16)
+{
+    return ((int64_t)a * dtQ16) >> 16;
+}
 
 void getEstimatedAltitude(void)
 {
-    uint8_t index;
     static uint32_t deadLine = INIT_DELAY;
-    static int16_t BaroHistTab[BARO_TAB_SIZE];
-    static int8_t BaroHistIdx;
-    static int32_t BaroHigh = 0;
-    static int32_t BaroLow = 0;
-    int32_t temp32;
-    int16_t last;
+    static uint32_t previousT = 0;
+    static int32_t altQ8, velQ8, accBiasQ16;
+    int32_t temp32, errQ8, accQ8 = 0;
+    uint32_t dtQ16;
 
-    if (currentTime < deadLine)
+    if (currentTime < INIT_DELAY)
         return;
-    deadLine = currentTime + UPDATE_INTERVAL;
+
+    if (previousT == 0) {
+        // start from the current baro reading at rest
+        altQ8 = BaroAlt << 8;
+        velQ8 = 0;
+        accBiasQ16 = 0;
+        previousT = currentTime;
+        accZSum = 0;
+        accZSamples = 0;
+        return;
+    }
+
+    // us to s in Q16. Capped at 100ms, past about 1s the product wraps and a long gap shouldn't kick the integrators anyway.
+    dtQ16 = (min(currentTime - previousT, 100000) * 4295) >> 16;
+    previousT = currentTime;
+
+    if (accZSamples) {
+        accQ8 = (accZSum / accZSamples) * (981 * 256) / acc_1G;
+        accZSum = 0;
+        accZSamples = 0;
+    }
+
+    errQ8 = (BaroAlt << 8) - altQ8;
+    accBiasQ16 += mulDt(errQ8 * ALT_CF_K3, dtQ16);
+    velQ8 += mulDt(accQ8 + (accBiasQ16 >> 8) + ((errQ8 * ALT_CF_K2) >> 8), dtQ16);
+    altQ8 += mulDt(velQ8 + ((errQ8 * ALT_CF_K1) >> 8), dtQ16);
+
+    EstAlt = altQ8 >> 8;
+    zVelocity = constrain(velQ8 >> 8, -32768, 32767);
 
     //**** Alt. Set Point stabilization PID ****
-    //calculate speed for D calculation
-    last = BaroHistTab[BaroHistIdx];
-    BaroHistTab[BaroHistIdx] = BaroAlt / 10;
-    BaroHigh += BaroHistTab[BaroHistIdx];
-    index = (BaroHistIdx + (BARO_TAB_SIZE / 2)) % BARO_TAB_SIZE;
-    BaroHigh -= BaroHistTab[index];
-    BaroLow  += BaroHistTab[index];
-    BaroLow  -= last;
-    BaroHistIdx++;
-    if (BaroHistIdx >= BARO_TAB_SIZE)
-        BaroHistIdx = 0;
+    if (currentTime < deadLine)
+        return;
+    deadLine = currentTime + UPDATE_INTERVAL;
 
     BaroPID = 0;
     //D
-    temp32 = cfg.D8[PIDALT] * (BaroHigh - BaroLow) / 40;
+    temp32 = cfg.D8[PIDALT] * zVelocity / 40;
     BaroPID -= temp32;
 
-    EstAlt = BaroHigh * 10 / (BARO_TAB_SIZE / 2);
-
     temp32 = AltHold - EstAlt;
     if (abs(temp32) < 10 && abs(BaroPID) < 10)
         BaroPID = 0;  // remove small D parameter to reduce noise near zero position
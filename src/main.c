@@ -3,10 +3,13 @@
 
 extern uint8_t useServo;
 extern rcReadRawDataPtr rcReadRawFunc;
+extern rcFrameCompletePtr rcFrameCompleteFunc;
+extern rcFrameTimePtr rcFrameTimeFunc;
 
 // two receiver read functions
 extern uint16_t pwmReadRawRC(uint8_t chan);
 extern uint16_t spektrumReadRawRC(uint8_t chan);
+extern uint16_t sbusReadRawRC(uint8_t chan);
 
 void throttleCalibration(void)
 {
@@ -19,12 +22,14 @@ void throttleCalibration(void)
     // write maxthrottle (high)
     for (i = offset; i < len; i++)
         pwmWrite(i, cfg.maxthrottle);
+    pwmCompleteMotorUpdate();
 
     delay(3000); // 3s delay on high
 
     // write 1000us (low)
     for (i = offset; i < len; i++)
         pwmWrite(i, 1000);
+    pwmCompleteMotorUpdate();
 
     // blink leds to show we're calibrated and time to remove bind plug
     failureMode(4);
@@ -62,6 +67,7 @@ int main(void)
 
     readEEPROM();
     checkFirstTime(false);
+    flashLogInit();
 
     serialInit(cfg.serial_baudrate);
 
@@ -77,16 +83,22 @@ int main(void)
     mixerInit(); // this will set useServo var depending on mixer type
     // pwmInit returns true if throttle calibration is requested. if so, do it here. throttleCalibration() does NOT return - for safety.
     pwm_params.usePPM = feature(FEATURE_PPM);
-    pwm_params.enableInput = !feature(FEATURE_SPEKTRUM); // disable inputs if using spektrum
+    pwm_params.enableInput = !feature(FEATURE_SPEKTRUM) && !feature(FEATURE_SBUS); // disable inputs if using spektrum or sbus
     pwm_params.useServos = useServo;
     pwm_params.motorPwmRate = cfg.motor_pwm_rate;
     pwm_params.servoPwmRate = cfg.servo_pwm_rate;
+    pwm_params.motorOneShot = cfg.motor_oneshot;
 
     if (pwmInit(&pwm_params))
         throttleCalibration(); // noreturn
 
-    // configure PWM/CPPM read function. spektrum will override that
+    // configure PWM/CPPM read function. spektrum or sbus will override that
+    for (i = 0; i < RC_CHANS; i++)
+        rcData[i] = 1500;
     rcReadRawFunc = pwmReadRawRC;
+    rcFrameCompleteFunc = pwmFrameComplete;
+    rcFrameTimeFunc = pwmFrameTime;
+    rcReceiverType = feature(FEATURE_PPM) ? RX_PPM : RX_PWM;
 
     LED1_ON;
     LED0_OFF;
@@ -112,8 +124,17 @@ int main(void)
     if (feature(FEATURE_SPEKTRUM)) {
         spektrumInit();
         rcReadRawFunc = spektrumReadRawRC;
+        rcFrameCompleteFunc = spektrumFrameComplete;
+        rcFrameTimeFunc = spektrumFrameTime;
+        rcReceiverType = RX_SPEKTRUM;
+    } else if (feature(FEATURE_SBUS)) {
+        sbusInit();
+        rcReadRawFunc = sbusReadRawRC;
+        rcFrameCompleteFunc = sbusFrameComplete;
+        rcFrameTimeFunc = sbusFrameTime;
+        rcReceiverType = RX_SBUS;
     } else {
-        // spektrum and GPS are mutually exclusive
+        // spektrum, sbus and GPS all use UART2, so they are mutually exclusive
         // Optional GPS - available only when using PPM, otherwise required pins won't be usable
         if (feature(FEATURE_PPM) && feature(FEATURE_GPS))
            gpsInit(cfg.gps_baudrate);
@@ -1,13 +1,152 @@
 #include "board.h"
 #include "mw.h"
 
-static uint8_t numberMotor = 4;
+uint8_t numberMotor = 4;
 uint8_t useServo = 0;
-int16_t motor[8];
+int16_t motor[MAX_MOTORS];
 int16_t servo[8] = { 1500, 1500, 1500, 1500, 1500, 1500, 1500, 1500 };
 
+static motorMixer_t currentMixer[MAX_MOTORS];  // active mix, yaw_direction already applied
+
+#define MIX(x) ((int16_t)((x) * (1 << MIXER_SHIFT) + ((x) < 0 ? -0.5f : 0.5f)))
+#define MIXROW(r, p, y) { MIX(1), MIX(r), MIX(p), MIX(y) }
+
+static const motorMixer_t mixerTri[] = {
+    MIXROW(0, 4.0f / 3, 0),             // REAR
+    MIXROW(-1, -2.0f / 3, 0),           // RIGHT
+    MIXROW(1, -2.0f / 3, 0),            // LEFT
+};
+
+static const motorMixer_t mixerQuadP[] = {
+    MIXROW(0, 1, -1),                   // REAR
+    MIXROW(-1, 0, 1),                   // RIGHT
+    MIXROW(1, 0, 1),                    // LEFT
+    MIXROW(0, -1, -1),                  // FRONT
+};
+
+static const motorMixer_t mixerQuadX[] = {
+    MIXROW(-1, 1, -1),                  // REAR_R
+    MIXROW(-1, -1, 1),                  // FRONT_R
+    MIXROW(1, 1, 1),                    // REAR_L
+    MIXROW(1, -1, -1),                  // FRONT_L
+};
+
+static const motorMixer_t mixerBi[] = {
+    MIXROW(1, 0, 0),                    // LEFT
+    MIXROW(-1, 0, 0),                   // RIGHT
+};
+
+static const motorMixer_t mixerY6[] = {
+    MIXROW(0, 4.0f / 3, 1),             // REAR
+    MIXROW(-1, -2.0f / 3, -1),          // RIGHT
+    MIXROW(1, -2.0f / 3, -1),           // LEFT
+    MIXROW(0, 4.0f / 3, -1),            // UNDER_REAR
+    MIXROW(-1, -2.0f / 3, 1),           // UNDER_RIGHT
+    MIXROW(1, -2.0f / 3, 1),            // UNDER_LEFT
+};
+
+static const motorMixer_t mixerHex6P[] = {
+    MIXROW(-0.5f, 0.5f, 1),             // REAR_R
+    MIXROW(-0.5f, -0.5f, -1),           // FRONT_R
+    MIXROW(0.5f, 0.5f, 1),              // REAR_L
+    MIXROW(0.5f, -0.5f, -1),            // FRONT_L
+    MIXROW(0, -1, 1),                   // FRONT
+    MIXROW(0, 1, -1),                   // REAR
+};
+
+static const motorMixer_t mixerFlyingWing[] = {
+    MIXROW(0, 0, 0),                    // throttle only, surfaces are servos
+};
+
+static const motorMixer_t mixerY4[] = {
+    MIXROW(0, 1, -1),                   // REAR_1 CW
+    MIXROW(-1, -1, 0),                  // FRONT_R CCW
+    MIXROW(0, 1, 1),                    // REAR_2 CCW
+    MIXROW(1, -1, 0),                   // FRONT_L CW
+};
+
+static const motorMixer_t mixerHex6X[] = {
+    MIXROW(-0.5f, 0.5f, 1),             // REAR_R
+    MIXROW(-0.5f, -0.5f, 1),            // FRONT_R
+    MIXROW(0.5f, 0.5f, -1),             // REAR_L
+    MIXROW(0.5f, -0.5f, -1),            // FRONT_L
+    MIXROW(-1, 0, -1),                  // RIGHT
+    MIXROW(1, 0, 1),                    // LEFT
+};
+
+static const motorMixer_t mixerOctoX8[] = {
+    MIXROW(-1, 1, -1),                  // REAR_R
+    MIXROW(-1, -1, 1),                  // FRONT_R
+    MIXROW(1, 1, 1),                    // REAR_L
+    MIXROW(1, -1, -1),                  // FRONT_L
+    MIXROW(-1, 1, 1),                   // UNDER_REAR_R
+    MIXROW(-1, -1, -1),                 // UNDER_FRONT_R
+    MIXROW(1, 1, -1),                   // UNDER_REAR_L
+    MIXROW(1, -1, 1),                   // UNDER_FRONT_L
+};
+
+static const motorMixer_t mixerOctoFlatP[] = {
+    MIXROW(0.7f, -0.7f, 1),             // FRONT_L
+    MIXROW(-0.7f, -0.7f, 1),            // FRONT_R
+    MIXROW(-0.7f, 0.7f, 1),             // REAR_R
+    MIXROW(0.7f, 0.7f, 1),              // REAR_L
+    MIXROW(0, -1, -1),                  // FRONT
+    MIXROW(-1, 0, -1),                  // RIGHT
+    MIXROW(0, 1, -1),                   // REAR
+    MIXROW(1, 0, -1),                   // LEFT
+};
+
+static const motorMixer_t mixerOctoFlatX[] = {
+    MIXROW(1, -0.5f, 1),                // MIDFRONT_L
+    MIXROW(-0.5f, -1, 1),               // FRONT_R
+    MIXROW(-1, 0.5f, 1),                // MIDREAR_R
+    MIXROW(0.5f, 1, 1),                 // REAR_L
+    MIXROW(0.5f, -1, -1),               // FRONT_L
+    MIXROW(-1, -0.5f, -1),              // MIDFRONT_R
+    MIXROW(-0.5f, 1, -1),               // REAR_R
+    MIXROW(1, 0.5f, -1),                // MIDREAR_L
+};
+
+static const motorMixer_t mixerVtail4[] = {
+    MIXROW(0, 1, -0.5f),                // REAR_R
+    MIXROW(-1, -1, 0.2f),               // FRONT_R
+    MIXROW(0, 1, 0.5f),                 // REAR_L
+    MIXROW(1, -1, -0.2f),               // FRONT_L
+};
+
+typedef struct mixer_t {
+    uint8_t numberMotor;
+    const motorMixer_t *motor;
+} mixer_t;
+
+// indexed by MultiType, keep in sync with it
+static const mixer_t mixers[] = {
+    { 0, NULL },                        // 0 is not a valid type
+    { 3, mixerTri },
+    { 4, mixerQuadP },
+    { 4, mixerQuadX },
+    { 2, mixerBi },
+    { 0, NULL },                        // GIMBAL, servos only
+    { 6, mixerY6 },
+    { 6, mixerHex6P },
+    { 1, mixerFlyingWing },
+    { 4, mixerY4 },
+    { 6, mixerHex6X },
+    { 8, mixerOctoX8 },
+    { 8, mixerOctoFlatP },
+    { 8, mixerOctoFlatX },
+    { 0, NULL },                        // AIRPLANE, not implemented
+    { 0, NULL },                        // HELI_120_CCPM, not implemented
+    { 0, NULL },                        // HELI_90_DEG, not implemented
+    { 4, mixerVtail4 },
+    { 0, NULL },                        // CUSTOM, comes from cfg.customMixer
+};
+
 void mixerInit(void)
 {
+    const motorMixer_t *mix;
+    uint8_t i;
+
     // enable servos for mixes that require them. note, this shifts motor counts.
     if (cfg.mixerConfiguration == MULTITYPE_BI || cfg.mixerConfiguration == MULTITYPE_TRI || cfg.mixerConfiguration == MULTITYPE_GIMBAL || cfg.mixerConfiguration == MULTITYPE_FLYING_WING)
         useServo = 1;
@@ -15,38 +154,35 @@ void mixerInit(void)
     if (feature(FEATURE_SERVO_TILT) || feature(FEATURE_CAMTRIG))
         useServo = 1;
 
-    switch (cfg.mixerConfiguration) {
-        case MULTITYPE_GIMBAL:
-            numberMotor = 0;
-            break;
-        case MULTITYPE_FLYING_WING:
-            numberMotor = 1;
-            break;
-        case MULTITYPE_BI:
-            numberMotor = 2;
-            break;
-        case MULTITYPE_TRI:
-            numberMotor = 3;
-            break;
+    if (cfg.mixerConfiguration == MULTITYPE_CUSTOM) {
+        // custom mix ends at the first motor without throttle
+        mix = cfg.customMixer;
+        for (numberMotor = 0; numberMotor < MAX_MOTORS; numberMotor++)
+            if (mix[numberMotor].throttle == 0)
+                break;
+    } else if (cfg.mixerConfiguration < MULTITYPE_LAST) {
+        mix = mixers[cfg.mixerConfiguration].motor;
+        numberMotor = mixers[cfg.mixerConfiguration].numberMotor;
+    } else {
+        mix = NULL;
+        numberMotor = 0;
+    }
 
-        case MULTITYPE_QUADP:
-        case MULTITYPE_QUADX:
-        case MULTITYPE_Y4:
-        case MULTITYPE_VTAIL4:
-            numberMotor = 4;
-            break;
+    for (i = 0; i < numberMotor; i++) {
+        currentMixer[i] = mix[i];
+        currentMixer[i].yaw *= cfg.yaw_direction;
+    }
+}
 
-        case MULTITYPE_Y6:
-        case MULTITYPE_HEX6:
-        case MULTITYPE_HEX6X:
-            numberMotor = 6;
-            break;
+// copy a built-in mix into cfg.customMixer as a starting point for 'mmix'
+void mixerLoadMix(uint8_t index)
+{
+    uint8_t i;
 
-        case MULTITYPE_OCTOX8:
-        case MULTITYPE_OCTOFLATP:
-        case MULTITYPE_OCTOFLATX:
-            numberMotor = 8;
-            break;
+    memset(cfg.customMixer, 0, sizeof(cfg.customMixer));
+    if (index < MULTITYPE_LAST && mixers[index].motor) {
+        for (i = 0; i < mixers[index].numberMotor; i++)
+            cfg.customMixer[i] = mixers[index].motor[i];
     }
 }
 
@@ -80,6 +216,8 @@ void writeMotors(void)
 
     for (i = 0; i < numberMotor; i++)
         pwmWrite(i + offset, motor[i]);
+    // fire the pulse now in oneshot mode
+    pwmCompleteMotorUpdate();
 }
 
 void writeAllMotors(int16_t mc)
@@ -92,8 +230,6 @@ void writeAllMotors(int16_t mc)
     writeMotors();
 }
 
-#define PIDMIX(X,Y,Z) rcCommand[THROTTLE] + axisPID[ROLL] * X + axisPID[PITCH] * Y + cfg.yaw_direction * axisPID[YAW] * Z
-
 void mixTable(void)
 {
     int16_t maxMotor;
@@ -107,117 +243,27 @@ void mixTable(void)
         axisPID[YAW] = constrain(axisPID[YAW], -100 - abs(rcCommand[YAW]), +100 + abs(rcCommand[YAW]));
     }
 
-    switch (cfg.mixerConfiguration) {
+    for (i = 0; i < numberMotor; i++)
+        motor[i] = ((int32_t)rcCommand[THROTTLE] * currentMixer[i].throttle + (int32_t)axisPID[ROLL] * currentMixer[i].roll +
+            (int32_t)axisPID[PITCH] * currentMixer[i].pitch + (int32_t)axisPID[YAW] * currentMixer[i].yaw) >> MIXER_SHIFT;
 
+    // servo parts of the mixes
+    switch (cfg.mixerConfiguration) {
         case MULTITYPE_BI:
-            motor[0] = PIDMIX(+1, 0, 0);        //LEFT
-            motor[1] = PIDMIX(-1, 0, 0);        //RIGHT        
             servo[4] = constrain(1500 + (cfg.yaw_direction * axisPID[YAW]) + axisPID[PITCH], 1020, 2000);   //LEFT
             servo[5] = constrain(1500 + (cfg.yaw_direction * axisPID[YAW]) - axisPID[PITCH], 1020, 2000);   //RIGHT
             break;
 
         case MULTITYPE_TRI:
-            motor[0] = PIDMIX(0, +4 / 3, 0);    //REAR
-            motor[1] = PIDMIX(-1, -2 / 3, 0);   //RIGHT
-            motor[2] = PIDMIX(+1, -2 / 3, 0);   //LEFT
             servo[4] = constrain(cfg.tri_yaw_middle + cfg.yaw_direction * axisPID[YAW], TRI_YAW_CONSTRAINT_MIN, TRI_YAW_CONSTRAINT_MAX); //REAR
             break;
 
-        case MULTITYPE_QUADP:
-            motor[0] = PIDMIX(0, +1, -1);       //REAR
-            motor[1] = PIDMIX(-1, 0, +1);       //RIGHT
-            motor[2] = PIDMIX(+1, 0, +1);       //LEFT
-            motor[3] = PIDMIX(0, -1, -1);       //FRONT
-            break;
-
-        case MULTITYPE_QUADX:
-            motor[0] = PIDMIX(-1, +1, -1);      //REAR_R
-            motor[1] = PIDMIX(-1, -1, +1);      //FRONT_R
-            motor[2] = PIDMIX(+1, +1, +1);      //REAR_L
-            motor[3] = PIDMIX(+1, -1, -1);      //FRONT_L
-            break;
-
-        case MULTITYPE_Y4:
-            motor[0] = PIDMIX(+0, +1, -1);      //REAR_1 CW
-            motor[1] = PIDMIX(-1, -1, 0);       //FRONT_R CCW
-            motor[2] = PIDMIX(+0, +1, +1);      //REAR_2 CCW
-            motor[3] = PIDMIX(+1, -1, 0);       //FRONT_L CW
-            break;
-
-        case MULTITYPE_Y6:
-            motor[0] = PIDMIX(+0, +4 / 3, +1);  //REAR
-            motor[1] = PIDMIX(-1, -2 / 3, -1);  //RIGHT
-            motor[2] = PIDMIX(+1, -2 / 3, -1);  //LEFT
-            motor[3] = PIDMIX(+0, +4 / 3, -1);  //UNDER_REAR
-            motor[4] = PIDMIX(-1, -2 / 3, +1);  //UNDER_RIGHT
-            motor[5] = PIDMIX(+1, -2 / 3, +1);  //UNDER_LEFT    
-            break;
-
-        case MULTITYPE_HEX6:
-            motor[0] = PIDMIX(-1 / 2, +1 / 2, +1);      //REAR_R
-            motor[1] = PIDMIX(-1 / 2, -1 / 2, -1);      //FRONT_R
-            motor[2] = PIDMIX(+1 / 2, +1 / 2, +1);      //REAR_L
-            motor[3] = PIDMIX(+1 / 2, -1 / 2, -1);      //FRONT_L
-            motor[4] = PIDMIX(+0, -1, +1);      //FRONT
-            motor[5] = PIDMIX(+0, +1, -1);      //REAR
-            break;
-
-        case MULTITYPE_HEX6X:
-            motor[0] = PIDMIX(-1 / 2, +1 / 2, +1);      //REAR_R
-            motor[1] = PIDMIX(-1 / 2, -1 / 2, +1);      //FRONT_R
-            motor[2] = PIDMIX(+1 / 2, +1 / 2, -1);      //REAR_L
-            motor[3] = PIDMIX(+1 / 2, -1 / 2, -1);      //FRONT_L
-            motor[4] = PIDMIX(-1, +0, -1);      //RIGHT
-            motor[5] = PIDMIX(+1, +0, +1);      //LEFT
-            break;
-
-        case MULTITYPE_OCTOX8:
-            motor[0] = PIDMIX(-1, +1, -1);      //REAR_R
-            motor[1] = PIDMIX(-1, -1, +1);      //FRONT_R
-            motor[2] = PIDMIX(+1, +1, +1);      //REAR_L
-            motor[3] = PIDMIX(+1, -1, -1);      //FRONT_L
-            motor[4] = PIDMIX(-1, +1, +1);      //UNDER_REAR_R
-            motor[5] = PIDMIX(-1, -1, -1);      //UNDER_FRONT_R
-            motor[6] = PIDMIX(+1, +1, -1);      //UNDER_REAR_L
-            motor[7] = PIDMIX(+1, -1, +1);      //UNDER_FRONT_L
-            break;
-
-        case MULTITYPE_OCTOFLATP:
-            motor[0] = PIDMIX(+7 / 10, -7 / 10, +1);    //FRONT_L
-            motor[1] = PIDMIX(-7 / 10, -7 / 10, +1);    //FRONT_R
-            motor[2] = PIDMIX(-7 / 10, +7 / 10, +1);    //REAR_R
-            motor[3] = PIDMIX(+7 / 10, +7 / 10, +1);    //REAR_L
-            motor[4] = PIDMIX(+0, -1, -1);      //FRONT
-            motor[5] = PIDMIX(-1, +0, -1);      //RIGHT
-            motor[6] = PIDMIX(+0, +1, -1);      //REAR
-            motor[7] = PIDMIX(+1, +0, -1);      //LEFT 
-            break;
-
-        case MULTITYPE_OCTOFLATX:
-            motor[0] = PIDMIX(+1, -1 / 2, +1);  //MIDFRONT_L
-            motor[1] = PIDMIX(-1 / 2, -1, +1);  //FRONT_R
-            motor[2] = PIDMIX(-1, +1 / 2, +1);  //MIDREAR_R
-            motor[3] = PIDMIX(+1 / 2, +1, +1);  //REAR_L
-            motor[4] = PIDMIX(+1 / 2, -1, -1);  //FRONT_L
-            motor[5] = PIDMIX(-1, -1 / 2, -1);  //MIDFRONT_R
-            motor[6] = PIDMIX(-1 / 2, +1, -1);  //REAR_R
-            motor[7] = PIDMIX(+1, +1 / 2, -1);  //MIDREAR_L 
-            break;
-
-        case MULTITYPE_VTAIL4:
-            motor[0] = PIDMIX(+0, +1, -1 / 2);      //REAR_R 
-            motor[1] = PIDMIX(-1, -1, +2 / 10); //FRONT_R 
-            motor[2] = PIDMIX(+0, +1, +1 / 2);      //REAR_L 
-            motor[3] = PIDMIX(+1, -1, -2 / 10); //FRONT_L
-            break;
-
         case MULTITYPE_GIMBAL:
             servo[0] = constrain(cfg.gimbal_pitch_mid + cfg.gimbal_pitch_gain * angle[PITCH] / 16 + rcCommand[PITCH], cfg.gimbal_pitch_min, cfg.gimbal_pitch_max);
             servo[1] = constrain(cfg.gimbal_roll_mid + cfg.gimbal_roll_gain * angle[ROLL] / 16 + rcCommand[ROLL], cfg.gimbal_roll_min, cfg.gimbal_roll_max);
             break;
 
         case MULTITYPE_FLYING_WING:
-            motor[0] = rcCommand[THROTTLE];
             if (passThruMode) { // do not use sensors for correction, simple 2 channel mixing
                 servo[0]  = PITCH_DIRECTION_L * (rcData[PITCH] - cfg.midrc) + ROLL_DIRECTION_L * (rcData[ROLL] - cfg.midrc);
                 servo[1]  = PITCH_DIRECTION_R * (rcData[PITCH] - cfg.midrc) + ROLL_DIRECTION_R * (rcData[ROLL] - cfg.midrc);
@@ -22,10 +22,17 @@ uint8_t vbat;                   // battery voltage in 0.1V steps
 
 volatile int16_t failsafeCnt = 0;
 int16_t failsafeEvents = 0;
-int16_t rcData[8] = { 1500, 1500, 1500, 1500, 1500, 1500, 1500, 1500 };              // interval [1000;2000]
+int16_t rcData[RC_CHANS];       // interval [1000;2000]
 int16_t rcCommand[4];           // interval [1000;2000] for THROTTLE and [-500;+500] for ROLL/PITCH/YAW 
-int16_t lookupRX[7];            // lookup table for expo & RC rate
+int16_t lookupPitchRollRC[RC_LOOKUP_LENGTH];        // lookup tables built by readEEPROM()
+int16_t lookupThrottleRC[THROTTLE_LOOKUP_LENGTH];
 rcReadRawDataPtr rcReadRawFunc = NULL; // receive data from default (pwm/ppm) or additional (spek/sbus/?? receiver drivers)
+rcFrameCompletePtr rcFrameCompleteFunc = NULL; // true once per new frame from the active receiver driver
+uint32_t rcFrameTime = 0;       // loop time the last receiver frame was processed
+uint32_t rcFrameInterval = 20000; // averaged receiver frame interval in us
+rcFrameTimePtr rcFrameTimeFunc = NULL; // capture time of the last frame, from the receiver driver
+uint8_t rcReceiverType = RX_PWM;
+uint16_t rcLatencyMin = 0xffff, rcLatencyAvg = 0, rcLatencyMax = 0;  // frame capture to first motor update, us
 
 uint8_t dynP8[3], dynI8[3], dynD8[3];
 uint8_t rcOptions[CHECKBOXITEMS];
@@ -35,6 +42,7 @@ uint8_t magMode = 0;            // if compass heading hold is a activated
 uint8_t baroMode = 0;           // if altitude hold is activated
 
 int16_t axisPID[3];
+int16_t axisP[3], axisI[3], axisD[3];  // terms of axisPID, for the blackbox
 
 // **********************
 // GPS
@@ -91,8 +99,11 @@ void annexCode(void)
     uint16_t vbatRaw = 0;
     static uint16_t vbatRawArray[8];
     uint8_t i;
+    static int16_t rcCommandFrom[4], rcCommandLast[4];
+    static uint32_t rcRampStart = 0;
 
     // PITCH & ROLL only dynamic PID adjustemnt,  depending on throttle value
+    // the rate attenuations are linear with a constant divisor, cheap enough without a table
     if (rcData[THROTTLE] < 1500) {
         prop2 = 100;
     } else if (rcData[THROTTLE] < 2000) {
@@ -104,26 +115,12 @@ void annexCode(void)
     for (axis = 0; axis < 3; axis++) {
         uint16_t tmp = min(abs(rcData[axis] - cfg.midrc), 500);
         if (axis != 2) {        // ROLL & PITCH
-            uint16_t tmp2;
-            if (cfg.deadband) {
-                if (tmp > cfg.deadband) {
-                    tmp -= cfg.deadband;
-                } else {
-                    tmp = 0;
-                }
-            }
-            tmp2 = tmp / 100;
-            rcCommand[axis] = lookupRX[tmp2] + (tmp - tmp2 * 100) * (lookupRX[tmp2 + 1] - lookupRX[tmp2]) / 100;
+            rcCommand[axis] = lookupPitchRollRC[tmp];
+            tmp = tmp > cfg.deadband ? tmp - cfg.deadband : 0;
             prop1 = 100 - (uint16_t) cfg.rollPitchRate * tmp / 500;
             prop1 = (uint16_t)prop1 * prop2 / 100;
         } else {                // YAW
-            if (cfg.yawdeadband) {
-                if (tmp > cfg.yawdeadband) {
-                    tmp -= cfg.yawdeadband;
-                } else {
-                    tmp = 0;
-                }
-            }
+            tmp = tmp > cfg.yawdeadband ? tmp - cfg.yawdeadband : 0;
             rcCommand[axis] = tmp;
             prop1 = 100 - (uint16_t)cfg.yawRate * tmp / 500;
         }
@@ -132,7 +129,26 @@ void annexCode(void)
         if (rcData[axis] < cfg.midrc)
             rcCommand[axis] = -rcCommand[axis];
     }
-    rcCommand[THROTTLE] = cfg.minthrottle + (int32_t)(cfg.maxthrottle - cfg.minthrottle) * (rcData[THROTTLE] - cfg.mincheck) / (2000 - cfg.mincheck);
+    rcCommand[THROTTLE] = lookupThrottleRC[constrain(rcData[THROTTLE] - 1000, 0, THROTTLE_LOOKUP_LENGTH - 1)];
+
+    // ramp from the previous output to the new setpoint over one frame interval instead of stepping on frame arrival
+    if (cfg.rc_interpolation) {
+        uint32_t elapsed;
+
+        if (rcRampStart != rcFrameTime) {
+            rcRampStart = rcFrameTime;
+            for (axis = 0; axis < 4; axis++)
+                rcCommandFrom[axis] = rcCommandLast[axis];
+        }
+        elapsed = currentTime - rcRampStart;
+        if (elapsed < rcFrameInterval) {
+            int32_t ratio = (elapsed << 8) / rcFrameInterval;
+            for (axis = 0; axis < 4; axis++)
+                rcCommand[axis] = rcCommandFrom[axis] + (((rcCommand[axis] - rcCommandFrom[axis]) * ratio) >> 8);
+        }
+        for (axis = 0; axis < 4; axis++)
+            rcCommandLast[axis] = rcCommand[axis];
+    }
 
     if (headFreeMode) {
         float radDiff = (heading - headFreeModeHold) * M_PI / 180.0f;
@@ -201,7 +217,11 @@ void annexCode(void)
             calibratedACC = 1;
     }
 
-    serialCom();
+    // the blackbox has the serial port to itself while it's logging
+    if (!blackboxIsLogging()) {
+        serialCom();
+        serialTelemetry();
+    }
 
     if (sensors(SENSOR_GPS)) {
         static uint32_t GPSLEDTime;
@@ -226,12 +246,12 @@ uint16_t pwmReadRawRC(uint8_t chan)
 
 void computeRC(void)
 {
-    static int16_t rcData4Values[8][4], rcDataMean[8];
+    static int16_t rcData4Values[RC_CHANS][4], rcDataMean[RC_CHANS];
     static uint8_t rc4ValuesIndex = 0;
     uint8_t chan, a;
 
     rc4ValuesIndex++;
-    for (chan = 0; chan < 8; chan++) {
+    for (chan = 0; chan < RC_CHANS; chan++) {
         rcData4Values[chan][rc4ValuesIndex % 4] = rcReadRawFunc(chan);
         rcDataMean[chan] = 0;
         for (a = 0; a < 4; a++)
@@ -245,10 +265,22 @@ void computeRC(void)
     }
 }
 
+// true if the box is assigned to any aux switch position
+static bool boxHasAux(uint8_t box)
+{
+    uint8_t i;
+
+    for (i = 0; i < AUX_PAIRS; i++)
+        if (cfg.activate[box][i])
+            return true;
+    return false;
+}
+
 void loop(void)
 {
     static uint8_t rcDelayCommand;      // this indicates the number of time (multiple of RC measurement at 50Hz) the sticks must be maintained to run or switch off motors
-    uint8_t axis, i;
+    uint8_t axis, i, j;
+    uint8_t auxState[AUX_PAIRS], auxActive;
     int16_t error, errorAngle;
     int16_t delta, deltaSum;
     int16_t PTerm, ITerm, DTerm;
@@ -258,16 +290,26 @@ void loop(void)
     static int16_t errorAngleI[2] = { 0, 0 };
     static uint32_t rcTime = 0;
     static int16_t initialThrottleHold;
+    static uint32_t rcSampleTime = 0, rcLatencyAvgX16 = 0;
+    static bool rcLatencyPending = false;
+    uint32_t frameInterval, latency;
+
+    // serial receiver / GPS bytes collected by DMA go to their parser here, not in an interrupt
+    uart2Process();
 
-    // this will return false if spektrum is disabled. shrug.
-    if (spektrumFrameComplete())
+    // process RC as soon as the receiver has a new frame instead of waiting for the 50Hz slot
+    if (rcFrameCompleteFunc()) {
         computeRC();
+        rcSampleTime = rcFrameTimeFunc();
+        rcLatencyPending = true;
+        frameInterval = currentTime - rcFrameTime;
+        if (frameInterval < 50000)  // ignore gaps from lost frames
+            rcFrameInterval = (rcFrameInterval * 7 + frameInterval) / 8;
+        rcFrameTime = currentTime;
+    }
 
     if (currentTime > rcTime) { // 50Hz
         rcTime = currentTime + 20000;
-        // TODO clean this up. computeRC should handle this check
-        if (!feature(FEATURE_SPEKTRUM))
-            computeRC();
         // Failsafe routine - added by MIS
 #if defined(FAILSAFE)
         if (failsafeCnt > (5 * FAILSAVE_DELAY) && armed == 1) { // Stabilize, and set Throttle to specified level
@@ -307,7 +349,7 @@ void loop(void)
                         }
                     }
                 }
-            } else if ((cfg.activate1[BOXARM] > 0) || (cfg.activate2[BOXARM] > 0)) {
+            } else if (boxHasAux(BOXARM)) {
                 if (rcOptions[BOXARM] && okToArm) {
                     armed = 1;
                     headFreeModeHold = heading;
@@ -389,9 +431,17 @@ void loop(void)
             }
         }
 
+        // low/mid/high state of each aux channel is worked out once, packed the same way as cfg.activate
+        memset(auxState, 0, sizeof(auxState));
+        for (i = 0; i < RC_CHANS - 4; i++) {
+            int16_t aux = rcData[AUX1 + i];
+            auxState[i / 2] |= ((aux < 1300) | (1300 < aux && aux < 1700) << 1 | (aux > 1700) << 2) << ((i & 1) * 3);
+        }
         for (i = 0; i < CHECKBOXITEMS; i++) {
-            rcOptions[i] = (((rcData[AUX1] < 1300) | (1300 < rcData[AUX1] && rcData[AUX1] < 1700) << 1 | (rcData[AUX1] > 1700) << 2 | (rcData[AUX2] < 1300) << 3 | (1300 < rcData[AUX2] && rcData[AUX2] < 1700) << 4 | (rcData[AUX2] > 1700) << 5) & cfg.activate1[i])
-                || (((rcData[AUX3] < 1300) | (1300 < rcData[AUX3] && rcData[AUX3] < 1700) << 1 | (rcData[AUX3] > 1700) << 2 | (rcData[AUX4] < 1300) << 3 | (1300 < rcData[AUX4] && rcData[AUX4] < 1700) << 4 | (rcData[AUX4] > 1700) << 5) & cfg.activate2[i]);
+            auxActive = 0;
+            for (j = 0; j < AUX_PAIRS; j++)
+                auxActive |= auxState[j] & cfg.activate[i][j];
+            rcOptions[i] = auxActive != 0;
         }
 
         // note: if FAILSAFE is disable, failsafeCnt > 5*FAILSAVE_DELAY is always false
@@ -495,7 +545,7 @@ void loop(void)
             break;
         case 3:
             taskOrder++;
-#if 0                           // GPS - not used as we read gps data in interrupt mode
+#if 0                           // GPS - not used, gps data is parsed by uart2Process()
             GPS_NewData();
 #endif
             break;
@@ -600,9 +650,30 @@ void loop(void)
         DTerm = ((int32_t)deltaSum * dynD8[axis]) >> 5;        //32 bits is needed for calculation
 
         axisPID[axis] = PTerm + ITerm - DTerm;
+        axisP[axis] = PTerm;
+        axisI[axis] = ITerm;
+        axisD[axis] = DTerm;
     }
 
     mixTable();
     writeServos();
     writeMotors();
+
+    // stick to motor latency: from receiver capture to the first motor update computed from that frame
+    if (rcLatencyPending) {
+        rcLatencyPending = false;
+        latency = min(micros() - rcSampleTime, 0xffff);
+        if (rcLatencyAvgX16 == 0)
+            rcLatencyAvgX16 = latency << 4;
+        rcLatencyAvgX16 += latency - (rcLatencyAvgX16 >> 4);
+        rcLatencyAvg = rcLatencyAvgX16 >> 4;
+        if (latency < rcLatencyMin)
+            rcLatencyMin = latency;
+        if (latency > rcLatencyMax)
+            rcLatencyMax = latency;
+    }
+
+    if (feature(FEATURE_BLACKBOX))
+        blackboxUpdate();
+    flashLogUpdate();
 }
@@ -72,7 +72,8 @@ typedef enum MultiType
     MULTITYPE_HELI_120_CCPM = 15,   // simple model
     MULTITYPE_HELI_90_DEG = 16,     // simple model
     MULTITYPE_VTAIL4 = 17,
-    MULTITYPE_LAST = 18
+    MULTITYPE_CUSTOM = 18,          // mix from cfg.customMixer, set up with 'mmix' in the CLI
+    MULTITYPE_LAST = 19
 } MultiType;
 
 typedef enum GimbalFlags {
@@ -81,6 +82,13 @@ typedef enum GimbalFlags {
     GIMBAL_DISABLEAUX34 = 1 << 2,
 } GimbalFlags;
 
+typedef enum {
+    RX_PWM = 0,
+    RX_PPM,
+    RX_SPEKTRUM,
+    RX_SBUS
+} rxType_e;
+
 /*********** RC alias *****************/
 #define ROLL       0
 #define PITCH      1
@@ -91,6 +99,14 @@ typedef enum GimbalFlags {
 #define AUX3       6
 #define AUX4       7
 
+#if RC_CHANS < 8 || RC_CHANS > 16
+#error "RC_CHANS must be between 8 and 16"
+#endif
+#define AUX_PAIRS  ((RC_CHANS - 4 + 1) / 2)    // each activate byte holds low/mid/high bits for two aux channels
+
+#define RC_LOOKUP_LENGTH        501     // stick deflection from midrc, 0..500
+#define THROTTLE_LOOKUP_LENGTH  1001    // throttle rcData, 1000..2000
+
 #define PIDALT     3
 #define PIDVEL     4
 #define PIDGPS     5
@@ -117,6 +133,17 @@ typedef enum GimbalFlags {
 #define abs(x) ((x) > 0 ? (x) : -(x))
 #define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
 
+#define MAX_MOTORS 8
+#define MIXER_SHIFT 8                       // mixer coefficients are Q8, 256 = 1.0
+
+// one motor's share of throttle and each axis PID
+typedef struct motorMixer_t {
+    int16_t throttle;
+    int16_t roll;
+    int16_t pitch;
+    int16_t yaw;
+} motorMixer_t;
+
 typedef struct config_t {
     uint8_t version;
     uint8_t mixerConfiguration;
@@ -138,20 +165,23 @@ typedef struct config_t {
 
     // sensor-related stuff
     uint8_t acc_lpf_factor;                 // Set the Low Pass Filter factor for ACC. Increasing this value would reduce ACC noise (visible in GUI), but would increase ACC lag time. Zero = no filter
+    uint8_t acc_sample_div;                 // Read ACC only every Nth loop, gyro is still read every loop. LPF and complementary filter run per ACC sample, scaled to keep their time constants
     uint16_t gyro_lpf;                      // mpuX050 LPF setting
     uint32_t gyro_smoothing_factor;         // How much to smoothen with per axis (32bit value with Roll, Pitch, Yaw in bits 24, 16, 8 respectively
+    uint16_t notch_min_hz;                  // lowest noise frequency the dynamic gyro notch will track
+    uint8_t notch_q;                        // quality factor of the dynamic gyro notch in 0.1 steps, higher is narrower
 
-    uint8_t activate1[CHECKBOXITEMS];
-    uint8_t activate2[CHECKBOXITEMS];
+    uint8_t activate[CHECKBOXITEMS][AUX_PAIRS]; // [0] is AUX1/AUX2, [1] is AUX3/AUX4 and so on
     uint8_t vbatscale;                      // adjust this to match battery voltage to reported value
     uint8_t vbatmaxcellvoltage;             // maximum voltage per cell, used for auto-detecting battery voltage in 0.1V units, default is 43 (4.3V)
     uint8_t vbatmincellvoltage;             // minimum voltage per cell, this triggers battery out alarms, in 0.1V units, default is 33 (3.3V)
 
     // Radio/ESC-related configuration
-    uint8_t rcmap[8];                       // mapping of radio channels to internal RPYTA+ order
+    uint8_t rcmap[RC_CHANS];                // mapping of radio channels to internal RPYTA+ order
     uint8_t deadband;                       // introduce a deadband around the stick center for pitch and roll axis. Must be greater than zero.
     uint8_t yawdeadband;                    // introduce a deadband around the stick center for yaw axis. Must be greater than zero.
     uint8_t spektrum_hires;                 // spektrum high-resolution y/n (1024/2048bit)
+    uint8_t rc_interpolation;               // interpolate rcCommand between receiver frames y/n
     uint16_t midrc;                         // Some radios have not a neutral point centered on 1500. can be changed here
     uint16_t mincheck;                      // minimum rc end
     uint16_t maxcheck;                      // maximum rc end
@@ -162,9 +192,11 @@ typedef struct config_t {
     uint16_t mincommand;                    // This is the value for the ESCs when they are not armed. In some cases, this value must be lowered down to 900 for some specific ESCs
     uint16_t motor_pwm_rate;                // The update rate of motor outputs (50-498Hz)
     uint16_t servo_pwm_rate;                // The update rate of servo outputs (50-498Hz)
+    uint8_t motor_oneshot;                  // 0 = free running motor PWM, 1 = one pulse per loop, 2 = OneShot125
 
     // mixer-related configuration
     int8_t yaw_direction;
+    motorMixer_t customMixer[MAX_MOTORS];   // custom mix, used motors have a non-zero throttle share
     uint16_t wing_left_mid;                 // left servo center pos. - use this for initial trim
     uint16_t wing_right_mid;                // right servo center pos. - use this for initial trim
     uint16_t tri_yaw_middle;                // tail servo center pos. - use this for initial trim
@@ -187,12 +219,15 @@ typedef struct config_t {
 
    // serial(uart1) baudrate
     uint32_t serial_baudrate;
+
+    uint8_t blackbox_rate_div;              // blackbox logs every Nth loop iteration
 } config_t;
 
 extern int16_t gyroZero[3];
 extern int16_t gyroData[3];
 extern int16_t angle[2];
 extern int16_t axisPID[3];
+extern int16_t axisP[3], axisI[3], axisD[3];
 extern int16_t rcCommand[4];
 extern uint8_t rcOptions[CHECKBOXITEMS];
 
@@ -221,9 +256,12 @@ extern uint8_t passThruMode;
 extern int8_t smallAngle25;
 extern int16_t zVelocity;
 extern int16_t heading, magHold;
-extern int16_t motor[8];
+extern int16_t motor[MAX_MOTORS];
 extern int16_t servo[8];
-extern int16_t rcData[8];
+extern int16_t rcData[RC_CHANS];
+extern uint32_t rcFrameInterval;
+extern uint8_t rcReceiverType;
+extern uint16_t rcLatencyMin, rcLatencyAvg, rcLatencyMax;
 extern uint8_t accMode;
 extern uint8_t magMode;
 extern uint8_t baroMode;
@@ -241,7 +279,11 @@ extern uint16_t GPS_altitude;
 extern uint16_t GPS_speed;                      // altitude in 0.1m and speed in 0.1m/s - Added by Mis
 extern int16_t GPS_heading;                    // heading in degrees
 extern uint8_t vbat;
-extern int16_t lookupRX[7];     //  lookup table for expo & RC rate
+extern int16_t lookupPitchRollRC[RC_LOOKUP_LENGTH];        // expo & RC rate incl. deadband, by stick deflection
+extern int16_t lookupThrottleRC[THROTTLE_LOOKUP_LENGTH];   // rcCommand[THROTTLE], by throttle above 1000
+extern uint16_t notchCenterHz[3];
+extern uint16_t accSampleSeq, magSampleSeq;
+extern uint32_t imuAccUpdates, imuAccSkips, imuMagUpdates, imuMagSkips;
 
 extern config_t cfg;
 extern sensor_t acc;
@@ -257,6 +299,42 @@ void computeIMU(void);
 void blinkLED(uint8_t num, uint8_t wait, uint8_t repeat);
 void getEstimatedAltitude(void);
 
+// Dynamic notch
+void dynNotchInit(void);
+void dynNotchUpdate(void);
+
+// Flash log
+typedef enum {
+    FLASHLOG_BOOT = 1,                      // data0: config version
+    FLASHLOG_ARM,                           // data0: vbat
+    FLASHLOG_DISARM,                        // flight summary. param: failsafe events, data0: seconds | max cycleTime << 16,
+                                            // data1: min vbat | i2c errors << 8 | loop overruns << 16
+    FLASHLOG_FAILSAFE,                      // first failsafe of a flight
+    FLASHLOG_I2C_ERROR,                     // first i2c error of a flight, data0: count
+    FLASHLOG_LOOP_OVERRUN,                  // first overrun of a flight, data0: cycleTime
+    FLASHLOG_BLANK = 0xFF                   // erased flash
+} flashLogEvent_e;
+
+typedef struct flashLogRecord_t {
+    uint8_t type;                           // flashLogEvent_e
+    uint8_t param;
+    uint16_t seq;                           // keeps counting across reboots, finds the newest record
+    uint32_t time;                          // millis() since boot
+    uint32_t data[2];
+} flashLogRecord_t;
+
+void flashLogInit(void);
+void flashLogEvent(uint8_t type, uint8_t param, uint32_t data0, uint32_t data1);
+void flashLogUpdate(void);
+bool flashLogRead(uint16_t index, flashLogRecord_t *rec);
+void flashLogErase(void);
+uint32_t flashLogLostRecords(void);
+
+// Blackbox
+void blackboxUpdate(void);
+bool blackboxIsLogging(void);
+void blackboxGetStats(uint32_t *written, uint32_t *dropped, uint32_t *avgCycles, uint32_t *maxCycles);
+
 // Sensors
 void sensorsAutodetect(void);
 void batteryInit(void);
@@ -273,10 +351,12 @@ void writeServos(void);
 void writeMotors(void);
 void writeAllMotors(int16_t mc);
 void mixTable(void);
+void mixerLoadMix(uint8_t index);
 
 // Serial
 void serialInit(uint32_t baudrate);
 void serialCom(void);
+void serialTelemetry(void);
 
 // Config
 void parseRcChannels(const char *input);
@@ -296,6 +376,12 @@ uint32_t featureMask(void);
 // spektrum
 void spektrumInit(void);
 bool spektrumFrameComplete(void);
+uint32_t spektrumFrameTime(void);
+
+// sbus
+void sbusInit(void);
+bool sbusFrameComplete(void);
+uint32_t sbusFrameTime(void);
 
 // cli
 void cliProcess(void);
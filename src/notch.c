@@ -0,0 +1,217 @@
+#include "board.h"
+#include "mw.h"
+
+// Dynamic gyro notch filter
+// A 64 point fixed-point FFT runs over a ring of recent gyro samples, one small step per loop,
+// so the whole analysis for one axis is spread over ~10 cycles and never adds a noticeable spike to cycleTime.
+// The dominant noise peak of each axis retunes a biquad notch that runs on gyroData every loop.
+
+#define NOTCH_FFT_SIZE      64
+#define NOTCH_FFT_LOG2      6
+#define NOTCH_BIN_COUNT     (NOTCH_FFT_SIZE / 2)
+#define NOTCH_COEF_SHIFT    14          // biquad coefficients are Q14
+
+typedef enum {
+    NOTCH_STEP_CAPTURE = 0,
+    NOTCH_STEP_FFT,                     // NOTCH_FFT_LOG2 steps, one butterfly stage each
+    NOTCH_STEP_PEAK = NOTCH_STEP_FFT + NOTCH_FFT_LOG2,
+    NOTCH_STEP_RETUNE
+} notchStep_e;
+
+typedef struct biquad_t {
+    int32_t b0, b1, b2, a1, a2;
+    int32_t x1, x2, y1, y2;
+} biquad_t;
+
+uint16_t notchCenterHz[3];              // current notch center per axis, 0 = not tuned yet
+
+static int16_t gyroRing[3][NOTCH_FFT_SIZE];
+static uint8_t gyroRingIdx = 0;
+static bool gyroRingFull = false;
+static uint32_t avgCycleTime = 0;       // loop period in 1/16 us, sets the FFT sample rate
+
+static int16_t fftRe[NOTCH_FFT_SIZE];
+static int16_t fftIm[NOTCH_FFT_SIZE];
+static int16_t fftCos[NOTCH_BIN_COUNT]; // Q15 twiddles
+static int16_t fftSin[NOTCH_BIN_COUNT];
+static int16_t fftWindow[NOTCH_FFT_SIZE]; // Q15 hann window
+static uint8_t fftBitRev[NOTCH_FFT_SIZE];
+static uint16_t peakBinX16;             // detected peak, in 1/16 bin
+static uint8_t notchStep = NOTCH_STEP_CAPTURE;
+static uint8_t notchAxis = 0;
+
+static biquad_t notch[3];
+
+void dynNotchInit(void)
+{
+    uint8_t i, b;
+
+    for (i = 0; i < NOTCH_BIN_COUNT; i++) {
+        fftCos[i] = cosf(2.0f * M_PI * i / NOTCH_FFT_SIZE) * 32767.0f;
+        fftSin[i] = sinf(2.0f * M_PI * i / NOTCH_FFT_SIZE) * 32767.0f;
+    }
+    for (i = 0; i < NOTCH_FFT_SIZE; i++) {
+        fftWindow[i] = (0.5f - 0.5f * cosf(2.0f * M_PI * i / (NOTCH_FFT_SIZE - 1))) * 32767.0f;
+        fftBitRev[i] = 0;
+        for (b = 0; b < NOTCH_FFT_LOG2; b++)
+            if (i & (1 << b))
+                fftBitRev[i] |= 1 << (NOTCH_FFT_LOG2 - 1 - b);
+    }
+
+    // start out as a passthrough filter until the first peak is found
+    for (i = 0; i < 3; i++) {
+        memset(&notch[i], 0, sizeof(biquad_t));
+        notch[i].b0 = 1 << NOTCH_COEF_SHIFT;
+        notchCenterHz[i] = 0;
+    }
+}
+
+static int16_t biquadApply(biquad_t *f, int16_t x)
+{
+    int32_t y;
+
+    y = (f->b0 * x + f->b1 * f->x1 + f->b2 * f->x2 - f->a1 * f->y1 - f->a2 * f->y2) >> NOTCH_COEF_SHIFT;
+    y = constrain(y, -32768, 32767);
+    f->x2 = f->x1;
+    f->x1 = x;
+    f->y2 = f->y1;
+    f->y1 = y;
+
+    return y;
+}
+
+// standard RBJ notch, coefficients normalized by a0. Only runs on retune, so float is fine here.
+static void biquadSetNotch(biquad_t *f, uint16_t hz, uint32_t sampleHz)
+{
+    float omega = 2.0f * M_PI * hz / sampleHz;
+    float alpha = sinf(omega) / (2.0f * cfg.notch_q / 10.0f);
+    float a0 = 1.0f + alpha;
+    float scale = (1 << NOTCH_COEF_SHIFT) / a0;
+
+    f->b0 = scale;
+    f->b1 = -2.0f * cosf(omega) * scale;
+    f->b2 = scale;
+    f->a1 = f->b1;
+    f->a2 = (1.0f - alpha) * scale;
+}
+
+// one radix-2 decimation in time stage, scaled by 1/2 so the 16bit buffer can't overflow
+static void fftStage(uint8_t stage)
+{
+    uint8_t half = 1 << stage;
+    uint8_t step = NOTCH_BIN_COUNT >> stage;
+    uint8_t i, j, k;
+
+    for (k = 0; k < half; k++) {
+        int32_t wr = fftCos[k * step];
+        int32_t wi = -fftSin[k * step];
+        for (i = k; i < NOTCH_FFT_SIZE; i += half * 2) {
+            int32_t tr, ti;
+            j = i + half;
+            tr = (wr * fftRe[j] - wi * fftIm[j]) >> 15;
+            ti = (wr * fftIm[j] + wi * fftRe[j]) >> 15;
+            fftRe[j] = (fftRe[i] - tr) >> 1;
+            fftIm[j] = (fftIm[i] - ti) >> 1;
+            fftRe[i] = (fftRe[i] + tr) >> 1;
+            fftIm[i] = (fftIm[i] + ti) >> 1;
+        }
+    }
+}
+
+// find the dominant bin above notch_min_hz. returns false if there is no clear peak above the noise floor.
+static bool fftFindPeak(uint32_t sampleHz)
+{
+    uint32_t power[NOTCH_BIN_COUNT];
+    uint32_t sum = 0, maxPower = 0, weighted;
+    uint8_t minBin, maxBin = 0, k;
+
+    minBin = constrain((uint32_t)cfg.notch_min_hz * NOTCH_FFT_SIZE / sampleHz, 1, NOTCH_BIN_COUNT - 2);
+
+    for (k = minBin - 1; k < NOTCH_BIN_COUNT; k++) {
+        power[k] = (int32_t)fftRe[k] * fftRe[k] + (int32_t)fftIm[k] * fftIm[k];
+        if (k < minBin)
+            continue;
+        sum += power[k];
+        if (power[k] > maxPower) {
+            maxPower = power[k];
+            maxBin = k;
+        }
+    }
+
+    // peak has to stand out well above the average, otherwise leave the notch where it was
+    if (maxBin == 0 || maxPower < 4 * (sum / (NOTCH_BIN_COUNT - minBin)))
+        return false;
+
+    // centroid of the peak and its neighbours for sub-bin resolution
+    if (maxBin < NOTCH_BIN_COUNT - 1) {
+        sum = (power[maxBin - 1] + power[maxBin] + power[maxBin + 1]) >> 4;
+        weighted = (power[maxBin - 1] >> 4) * (maxBin - 1) + (power[maxBin] >> 4) * maxBin + (power[maxBin + 1] >> 4) * (maxBin + 1);
+        peakBinX16 = sum ? weighted * 16 / sum : maxBin * 16;
+    } else {
+        peakBinX16 = maxBin * 16;
+    }
+
+    return true;
+}
+
+void dynNotchUpdate(void)
+{
+    uint8_t axis, i;
+    uint32_t sampleHz;
+
+    // track loop period, this is the sample rate of the ring
+    if (avgCycleTime == 0)
+        avgCycleTime = (uint32_t)cycleTime << 4;
+    avgCycleTime += cycleTime - (avgCycleTime >> 4);
+
+    for (axis = 0; axis < 3; axis++) {
+        gyroRing[axis][gyroRingIdx] = gyroData[axis];
+        gyroData[axis] = biquadApply(&notch[axis], gyroData[axis]);
+    }
+    gyroRingIdx = (gyroRingIdx + 1) % NOTCH_FFT_SIZE;
+    if (gyroRingIdx == 0)
+        gyroRingFull = true;
+
+    if (!gyroRingFull || avgCycleTime == 0)
+        return;
+
+    sampleHz = 16000000 / avgCycleTime;
+
+    // a single bounded piece of work per call
+    switch (notchStep) {
+        case NOTCH_STEP_CAPTURE:
+            // oldest sample first, windowed and stored in bit reversed order
+            for (i = 0; i < NOTCH_FFT_SIZE; i++) {
+                int16_t sample = gyroRing[notchAxis][(gyroRingIdx + i) % NOTCH_FFT_SIZE];
+                fftRe[fftBitRev[i]] = ((int32_t)sample * fftWindow[i]) >> 15;
+                fftIm[fftBitRev[i]] = 0;
+            }
+            notchStep++;
+            break;
+
+        case NOTCH_STEP_PEAK:
+            notchStep = fftFindPeak(sampleHz) ? NOTCH_STEP_RETUNE : NOTCH_STEP_CAPTURE;
+            if (notchStep == NOTCH_STEP_CAPTURE)
+                notchAxis = (notchAxis + 1) % 3;
+            break;
+
+        case NOTCH_STEP_RETUNE: {
+            uint16_t hz = (uint32_t)peakBinX16 * sampleHz / (NOTCH_FFT_SIZE * 16);
+            // keep clear of nyquist where the biquad gets unstable
+            hz = constrain(hz, cfg.notch_min_hz, sampleHz * 9 / 20);
+            if (notchCenterHz[notchAxis] == 0)
+                notchCenterHz[notchAxis] = hz;
+            else
+                notchCenterHz[notchAxis] = (notchCenterHz[notchAxis] * 3 + hz) / 4;
+            biquadSetNotch(&notch[notchAxis], notchCenterHz[notchAxis], sampleHz);
+            notchStep = NOTCH_STEP_CAPTURE;
+            notchAxis = (notchAxis + 1) % 3;
+            break;
+        }
+
+        default:
+            fftStage(notchStep - NOTCH_STEP_FFT);
+            notchStep++;
+            break;
+    }
+}
@@ -0,0 +1,134 @@
+#include "board.h"
+#include "mw.h"
+
+// driver for Futaba/FrSky SBUS receivers on UART2
+// SBUS is 100000 baud 8E2 with inverted logic levels, the STM32F1 USART can't invert so an external inverter is needed.
+// A frame is 25 bytes: 0x0F start byte, 16 channels of 11 bits packed LSB first, a flags byte and an end byte.
+
+#define SBUS_MAX_CHANNEL    16
+#define SBUS_FRAME_SIZE     25
+#define SBUS_FRAME_BEGIN    0x0F
+#define SBUS_FRAME_END      0x00
+#define SBUS2_FRAME_END     0x04        // SBUS2 telemetry slots 0x04/0x14/0x24/0x34, checked with SBUS2_END_MASK
+#define SBUS2_END_MASK      0xCF
+
+#define SBUS_FLAG_FRAME_LOST    (1 << 2)
+#define SBUS_FLAG_FAILSAFE      (1 << 3)
+
+static uint8_t sbusFrame[SBUS_FRAME_SIZE];
+static bool sbusDataIncoming = false;
+
+// same double buffering as the spektrum driver, readers only see complete frames
+static volatile uint16_t sbusChannelData[2][SBUS_MAX_CHANNEL];
+static volatile uint8_t sbusActiveBuffer = 0;
+static volatile uint16_t sbusFrameSeq = 0;
+static volatile uint32_t sbusLastFrameTime = 0;
+static uint16_t sbusFrameSeqSeen = 0;
+
+uint16_t sbusFrameLostCount = 0;        // frames the receiver flagged as lost
+uint16_t sbusFailsafeCount = 0;         // frames received while the receiver was in failsafe
+
+static void sbusDataReceive(const uint8_t *data, uint16_t len, uint32_t idleTime);
+
+void sbusInit(void)
+{
+    uart2Init(100000, sbusDataReceive, UART_8E2);
+}
+
+static void sbusDecodeFrame(void)
+{
+    uint8_t back = sbusActiveBuffer ^ 1;
+    uint32_t bits = 0;
+    uint8_t bitCount = 0, chan = 0, b;
+
+    for (b = 1; chan < SBUS_MAX_CHANNEL; b++) {
+        bits |= (uint32_t)sbusFrame[b] << bitCount;
+        bitCount += 8;
+        if (bitCount >= 11) {
+            sbusChannelData[back][chan++] = bits & 0x7FF;
+            bits >>= 11;
+            bitCount -= 11;
+        }
+    }
+
+    sbusActiveBuffer = back;
+    sbusFrameSeq++;
+}
+
+// UART2 receive callback, from uart2Process(). Frames are sent as one burst with a gap after,
+// the idle line at the end of the burst completes the frame.
+static void sbusDataReceive(const uint8_t *data, uint16_t len, uint32_t idleTime)
+{
+    static uint8_t sbusFramePosition;
+    uint8_t flags;
+
+    uint8_t end;
+
+    for (; len; len--, data++) {
+        if (sbusFramePosition == 0 && *data != SBUS_FRAME_BEGIN)
+            continue;
+        if (sbusFramePosition < SBUS_FRAME_SIZE)
+            sbusFrame[sbusFramePosition] = *data;
+        // one past the frame size marks a burst that was too long
+        if (sbusFramePosition <= SBUS_FRAME_SIZE)
+            sbusFramePosition++;
+    }
+    if (!idleTime)
+        return;
+    // anything but exactly one frame between two idles is noise, a partial frame or two frames run together
+    end = sbusFrame[SBUS_FRAME_SIZE - 1];
+    if (sbusFramePosition != SBUS_FRAME_SIZE || (end != SBUS_FRAME_END && (end & SBUS2_END_MASK) != SBUS2_FRAME_END)) {
+        sbusFramePosition = 0;
+        return;
+    }
+    sbusFramePosition = 0;
+
+    flags = sbusFrame[SBUS_FRAME_SIZE - 2];
+    if (flags & SBUS_FLAG_FRAME_LOST)
+        sbusFrameLostCount++;
+    // in failsafe the receiver repeats stale or preset values, keep the last good ones and let our failsafe kick in
+    if (flags & SBUS_FLAG_FAILSAFE) {
+        sbusFailsafeCount++;
+        return;
+    }
+
+    sbusLastFrameTime = idleTime;
+    sbusDecodeFrame();
+    sbusDataIncoming = true;
+#if defined(FAILSAFE)
+    if (failsafeCnt > 20)
+        failsafeCnt -= 20;
+    else
+        failsafeCnt = 0;   // clear FailSafe counter
+#endif
+}
+
+// true once per newly decoded frame
+bool sbusFrameComplete(void)
+{
+    uint16_t seq = sbusFrameSeq;
+
+    if (seq == sbusFrameSeqSeen)
+        return false;
+    sbusFrameSeqSeen = seq;
+    return true;
+}
+
+uint32_t sbusFrameTime(void)
+{
+    return sbusLastFrameTime;
+}
+
+uint16_t sbusReadRawRC(uint8_t chan)
+{
+    uint16_t data;
+
+    if (cfg.rcmap[chan] >= SBUS_MAX_CHANNEL || !sbusDataIncoming) {
+        data = cfg.midrc;
+    } else {
+        // 172..1811 maps to 988..2012us, same as the receiver's PWM outputs
+        data = (sbusChannelData[sbusActiveBuffer][cfg.rcmap[chan]] * 5 / 8) + 880;
+    }
+
+    return data;
+}
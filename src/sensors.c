@@ -7,6 +7,8 @@ uint16_t calibratingG = 0;
 uint8_t calibratingM = 0;
 uint16_t acc_1G = 256;         // this is the 1G measured acceleration
 int16_t heading, magHold;
+uint16_t accSampleSeq = 0;      // bumped for every new sample, lets the estimators skip stale data
+uint16_t magSampleSeq = 0;
 
 extern uint16_t InflightcalibratingA;
 extern int16_t AccInflightCalibrationArmed;
@@ -178,7 +180,16 @@ static void ACC_Common(void)
 
 void ACC_getADC(void)
 {
+    static int16_t accRaw[3];
+
     acc.read(accADC);
+    // ADXL345 only converts at 100Hz, an unchanged register set is not a new sample
+    if (accADC[0] != accRaw[0] || accADC[1] != accRaw[1] || accADC[2] != accRaw[2]) {
+        accRaw[0] = accADC[0];
+        accRaw[1] = accADC[1];
+        accRaw[2] = accADC[2];
+        accSampleSeq++;
+    }
     acc.align(accADC);
 
     ACC_Common();
@@ -353,6 +364,7 @@ void Mag_getADC(void)
         magADC[PITCH] -= cfg.magZero[PITCH];
         magADC[YAW] -= cfg.magZero[YAW];
     }
+    magSampleSeq++;
 
     if (tCal != 0) {
         if ((t - tCal) < 30000000) {    // 30s: you have 30s to turn the multi in all directions
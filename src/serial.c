@@ -20,145 +20,467 @@ void serialInit(uint32_t baudrate)
     uartInit(baudrate);
 }
 
-void serialCom(void)
+// Framed telemetry protocol. Each command returns a single data group, so a client can poll only what it needs.
+// request:  '$' 'T' '<' len cmd payload[len] checksum
+// response: '$' 'T' '>' len cmd payload[len] checksum
+// error:    '$' 'T' '!' 0 cmd checksum     (unknown command or bad checksum)
+// checksum is the xor of len, cmd and payload.
+// TLM_STREAM subscribes to groups instead: payload is (cmd, rate in Hz) pairs, rate 0 stops the stream.
+// Streamed groups are sent as normal responses by serialTelemetry(), within a share of the link bandwidth.
+#define FRAME_BUFFER_SIZE   64
+#define FRAME_OVERHEAD      6           // '$' 'T' dir len cmd checksum
+#define STREAM_MAX_RATE     100         // Hz, about a third of the loop rate
+#define STREAM_BANDWIDTH    75          // percent of the link, the rest is left for replies and the 'M' blob
+#define FRAME_TIMEOUT       100000      // us without a byte before a partial frame is dropped
+#define GUI_WRITE_SIZE      (3 * PIDITEMS + 5 + 2 * CHECKBOXITEMS + 2)
+#define BT_RC_SIZE          5
+#define SERIAL_TIME_BUDGET  500         // us per serialCom() call, the rest stays queued for the next loop
+
+enum {
+    TLM_ATTITUDE = 1,                   // angle[2], heading
+    TLM_RAW_IMU,                        // accSmooth[3], gyroData[3], magADC[3]
+    TLM_RC,                             // rcData[RC_CHANS]
+    TLM_MOTOR,                          // motor[MAX_MOTORS], servo[8]
+    TLM_STATUS,                         // cycleTime, i2c errors, sensors, modes, vbat, rc latency
+    TLM_CONFIG,                         // mixer, PID, rates
+    TLM_GROUPS,
+    TLM_STREAM = 16                     // (cmd, rate) pairs
+};
+
+typedef enum {
+    FRAME_IDLE = 0,
+    FRAME_HEADER_T,
+    FRAME_HEADER_DIR,
+    FRAME_LEN,
+    FRAME_CMD,
+    FRAME_PAYLOAD,
+    FRAME_CHECKSUM,
+    FRAME_LEGACY                        // fixed size payload of a single letter command ('W', 'K')
+} frameState_e;
+
+static uint8_t frameState = FRAME_IDLE;
+static uint8_t frameCmd;
+static uint8_t frameLen;
+static uint8_t frameChecksum;
+static uint8_t frameBuffer[FRAME_BUFFER_SIZE];     // request payload
+static uint8_t frameIdx;
+static uint32_t frameByteTime;                    // micros() of the last byte of a partial frame
+static uint8_t frameTxBuffer[FRAME_BUFFER_SIZE];   // response payload
+static uint8_t frameTxIdx;
+
+static uint8_t streamRate[TLM_GROUPS];
+static uint32_t streamNext[TLM_GROUPS];
+static uint8_t streamLast = 0;
+static uint32_t streamBudget = 0;                 // bytes we may send right now, in 1/1000000 byte
+static uint32_t streamTime = 0;
+
+static void frameWrite8(uint8_t a)
 {
+    if (frameTxIdx < FRAME_BUFFER_SIZE)
+        frameTxBuffer[frameTxIdx++] = a;
+}
+
+static void frameWrite16(int16_t a)
+{
+    frameWrite8(a);
+    frameWrite8(a >> 8 & 0xff);
+}
+
+// the whole frame goes out or none of it, a response never waits for room in txBuffer
+static bool frameSend(uint8_t dir, uint8_t cmd)
+{
+    uint8_t frame[FRAME_BUFFER_SIZE + FRAME_OVERHEAD];
+    uint8_t checksum = frameTxIdx ^ cmd;
     uint8_t i;
 
-    // in cli mode, all uart stuff goes to here. enter cli mode by sending #
-    if (cliMode) {
-        cliProcess();
-        return;
+    frame[0] = '$';
+    frame[1] = 'T';
+    frame[2] = dir;
+    frame[3] = frameTxIdx;
+    frame[4] = cmd;
+    for (i = 0; i < frameTxIdx; i++) {
+        frame[5 + i] = frameTxBuffer[i];
+        checksum ^= frameTxBuffer[i];
     }
+    frame[5 + i] = checksum;
 
-    if (uartAvailable()) {
-        switch (uartRead()) {
-        case '#':
-            cliProcess();
-            break;
-#ifdef BTSERIAL
-        case 'K':              // receive RC data from Bluetooth Serial adapter as a remote
-            rcData[THROTTLE] = (SerialRead(0) * 4) + 1000;
-            rcData[ROLL] = (SerialRead(0) * 4) + 1000;
-            rcData[PITCH] = (SerialRead(0) * 4) + 1000;
-            rcData[YAW] = (SerialRead(0) * 4) + 1000;
-            rcData[AUX1] = (SerialRead(0) * 4) + 1000;
+    return uartWriteIfRoom(frame, frameTxIdx + FRAME_OVERHEAD);
+}
+
+// fill frameTxBuffer with one data group, false if there is no such group
+static bool frameBuildGroup(uint8_t cmd)
+{
+    uint8_t i;
+
+    frameTxIdx = 0;
+
+    switch (cmd) {
+        case TLM_ATTITUDE:
+            for (i = 0; i < 2; i++)
+                frameWrite16(angle[i]);
+            frameWrite16(heading);
             break;
-#endif
-        case 'M':              // Multiwii @ arduino to GUI all data
-            serialize8('M');
-            serialize8(VERSION);        // MultiWii Firmware version
+        case TLM_RAW_IMU:
             for (i = 0; i < 3; i++)
-                serialize16(accSmooth[i]);
+                frameWrite16(accSmooth[i]);
             for (i = 0; i < 3; i++)
-                serialize16(gyroData[i]);
+                frameWrite16(gyroData[i]);
             for (i = 0; i < 3; i++)
-                serialize16(magADC[i]);
-            serialize16(EstAlt / 10);
-            serialize16(heading);       // compass
-            for (i = 0; i < 8; i++)
-                serialize16(servo[i]);
-            for (i = 0; i < 8; i++)
-                serialize16(motor[i]);
+                frameWrite16(magADC[i]);
+            break;
+        case TLM_RC:
+            for (i = 0; i < RC_CHANS; i++)
+                frameWrite16(rcData[i]);
+            break;
+        case TLM_MOTOR:
+            for (i = 0; i < MAX_MOTORS; i++)
+                frameWrite16(motor[i]);
             for (i = 0; i < 8; i++)
-                serialize16(rcData[i]);
-            serialize8(sensors(SENSOR_ACC) << 1 | sensors(SENSOR_BARO) << 2 | sensors(SENSOR_MAG) << 3 | sensors(SENSOR_GPS) << 4);
-            serialize8(accMode | baroMode << 1 | magMode << 2 | GPSModeHome << 3 | GPSModeHold << 4 | armed << 5);
-#if defined(LOG_VALUES)
-            serialize16(cycleTimeMax);
-            cycleTimeMax = 0;
-#else
-            serialize16(cycleTime);
-#endif
-            serialize16(i2cGetErrorCounter());
-            for (i = 0; i < 2; i++)
-                serialize16(angle[i]);
-            serialize8(cfg.mixerConfiguration);
+                frameWrite16(servo[i]);
+            break;
+        case TLM_STATUS:
+            frameWrite16(cycleTime);
+            frameWrite16(i2cGetErrorCounter());
+            frameWrite8(sensors(SENSOR_ACC) << 1 | sensors(SENSOR_BARO) << 2 | sensors(SENSOR_MAG) << 3 | sensors(SENSOR_GPS) << 4);
+            frameWrite8(accMode | baroMode << 1 | magMode << 2 | GPSModeHome << 3 | GPSModeHold << 4 | armed << 5);
+            frameWrite8(vbat);
+            frameWrite16(rcLatencyAvg);
+            break;
+        case TLM_CONFIG:
+            frameWrite8(cfg.mixerConfiguration);
             for (i = 0; i < PIDITEMS; i++) {
-                serialize8(cfg.P8[i]);
-                serialize8(cfg.I8[i]);
-                serialize8(cfg.D8[i]);
+                frameWrite8(cfg.P8[i]);
+                frameWrite8(cfg.I8[i]);
+                frameWrite8(cfg.D8[i]);
             }
-            serialize8(cfg.rcRate8);
-            serialize8(cfg.rcExpo8);
-            serialize8(cfg.rollPitchRate);
-            serialize8(cfg.yawRate);
-            serialize8(cfg.dynThrPID);
-            for (i = 0; i < CHECKBOXITEMS; i++) {
-                serialize8(cfg.activate1[i]);
-                serialize8(cfg.activate2[i] | (rcOptions[i] << 7)); // use highest bit to transport state in mwc
-            }
-            serialize16(GPS_distanceToHome);
-            serialize16(GPS_directionToHome + 180);
-            serialize8(GPS_numSat);
-            serialize8(GPS_fix);
-            serialize8(GPS_update);
-            serialize16(0);                 // power meter, removed
-            serialize16(0);                 // power meter, removed
-            serialize8(vbat);
-            serialize16(BaroAlt / 10);      // 4 variables are here for general monitoring purpose
-            serialize16(debug2);            // debug2
-            serialize16(debug3);            // debug3
-            serialize16(debug4);            // debug4
-            serialize8('M');
+            frameWrite8(cfg.rcRate8);
+            frameWrite8(cfg.rcExpo8);
+            frameWrite8(cfg.rollPitchRate);
+            frameWrite8(cfg.yawRate);
+            frameWrite8(cfg.dynThrPID);
             break;
-        case 'O':              // arduino to OSD data - contribution from MIS
-            serialize8('O');
-            for (i = 0; i < 3; i++)
-                serialize16(accSmooth[i]);
-            for (i = 0; i < 3; i++)
-                serialize16(gyroData[i]);
-            serialize16(EstAlt * 10.0f);
-            serialize16(heading);       // compass - 16 bytes
-            for (i = 0; i < 2; i++)
-                serialize16(angle[i]);  //20
-            for (i = 0; i < 6; i++)
-                serialize16(motor[i]);  //32
-            for (i = 0; i < 6; i++) {
-                serialize16(rcData[i]);
-            }                   //44
-            serialize8(sensors(SENSOR_ACC) << 1 | sensors(SENSOR_BARO) << 2 | sensors(SENSOR_MAG) << 3 | sensors(SENSOR_GPS) << 4);
-            serialize8(accMode | baroMode << 1 | magMode << 2 | GPSModeHome << 3 | GPSModeHold << 4 | armed << 5);
-            serialize8(vbat);   // Vbatt 47
-            serialize8(VERSION);        // MultiWii Firmware version
-            serialize8(GPS_fix);        // Fix indicator for OSD
-            serialize8(GPS_numSat);
-            serialize16(GPS_latitude);
-            serialize16(GPS_latitude >> 16);
-            serialize16(GPS_longitude);
-            serialize16(GPS_longitude >> 16);
-            serialize16(GPS_altitude);
-            serialize16(GPS_speed);            // Speed for OSD
-            serialize8('O');    // NOT 49 anymore
-            break;
-        case 'R':               // reboot to bootloader (oops, apparently this w as used for other trash, fix later)
-            systemReset(true);
+        default:
+            return false;
+    }
+    return true;
+}
+
+static void frameProcessCommand(void)
+{
+    uint8_t i, cmd;
+
+    if (frameCmd == TLM_STREAM) {
+        for (i = 0; i + 1 < frameLen; i += 2) {
+            cmd = frameBuffer[i];
+            if (cmd == 0 || cmd >= TLM_GROUPS)
+                continue;
+            streamRate[cmd] = min(frameBuffer[i + 1], STREAM_MAX_RATE);
+            streamNext[cmd] = micros();
+        }
+        frameTxIdx = 0;
+        frameSend('>', frameCmd);
+        return;
+    }
+
+    if (frameBuildGroup(frameCmd)) {
+        frameSend('>', frameCmd);
+    } else {
+        frameTxIdx = 0;
+        frameSend('!', frameCmd);
+    }
+}
+
+static void legacyStart(uint8_t cmd, uint8_t len)
+{
+    frameCmd = cmd;
+    frameLen = len;
+    frameIdx = 0;
+    frameState = FRAME_LEGACY;
+}
+
+static void legacyProcessCommand(void)
+{
+    uint8_t i, *p = frameBuffer;
+
+    switch (frameCmd) {
+#ifdef BTSERIAL
+        case 'K':              // receive RC data from Bluetooth Serial adapter as a remote
+            rcData[THROTTLE] = (*p++ * 4) + 1000;
+            rcData[ROLL] = (*p++ * 4) + 1000;
+            rcData[PITCH] = (*p++ * 4) + 1000;
+            rcData[YAW] = (*p++ * 4) + 1000;
+            rcData[AUX1] = (*p++ * 4) + 1000;
             break;
+#endif
         case 'W':              //GUI write params to eeprom @ arduino
-            // while (uartAvailable() < (7 + 3 * PIDITEMS + 2 * CHECKBOXITEMS)) { }
             for (i = 0; i < PIDITEMS; i++) {
-                cfg.P8[i] = uartReadPoll();
-                cfg.I8[i] = uartReadPoll();
-                cfg.D8[i] = uartReadPoll();
+                cfg.P8[i] = *p++;
+                cfg.I8[i] = *p++;
+                cfg.D8[i] = *p++;
             }
-            cfg.rcRate8 = uartReadPoll();
-            cfg.rcExpo8 = uartReadPoll();    //2
-            cfg.rollPitchRate = uartReadPoll();
-            cfg.yawRate = uartReadPoll();    //4
-            cfg.dynThrPID = uartReadPoll();  //5
+            cfg.rcRate8 = *p++;
+            cfg.rcExpo8 = *p++;    //2
+            cfg.rollPitchRate = *p++;
+            cfg.yawRate = *p++;    //4
+            cfg.dynThrPID = *p++;  //5
             for (i = 0; i < CHECKBOXITEMS; i++) {
-                cfg.activate1[i] = uartReadPoll();
-                cfg.activate2[i] = uartReadPoll();
+                cfg.activate[i][0] = *p++;   // GUI only knows AUX1-4, the rest is set from CLI
+                cfg.activate[i][1] = *p++;
             }
-            uartReadPoll();     // power meter crap, removed
-            uartReadPoll();     // power meter crap, removed
+            // last 2 bytes are power meter crap, removed
             writeParams();
             break;
-        case 'S':              // GUI to arduino ACC calibration request
-            calibratingA = 400;
+    }
+}
+
+// one byte at a time, so a frame never blocks the main loop
+static void frameParse(uint8_t c)
+{
+    switch (frameState) {
+        case FRAME_HEADER_T:
+            frameState = c == 'T' ? FRAME_HEADER_DIR : FRAME_IDLE;
+            break;
+        case FRAME_HEADER_DIR:
+            frameState = c == '<' ? FRAME_LEN : FRAME_IDLE;
+            break;
+        case FRAME_LEN:
+            if (c > FRAME_BUFFER_SIZE) {
+                frameState = FRAME_IDLE;
+                break;
+            }
+            frameLen = c;
+            frameChecksum = c;
+            frameState = FRAME_CMD;
+            break;
+        case FRAME_CMD:
+            frameCmd = c;
+            frameChecksum ^= c;
+            frameIdx = 0;
+            frameState = frameLen ? FRAME_PAYLOAD : FRAME_CHECKSUM;
+            break;
+        case FRAME_CHECKSUM:
+            frameState = FRAME_IDLE;
+            if (c == frameChecksum) {
+                frameProcessCommand();
+            } else {
+                frameTxIdx = 0;
+                frameSend('!', frameCmd);
+            }
             break;
-        case 'E':              // GUI to arduino MAG calibration request
-            calibratingM = 1;
+    }
+}
+
+// payloads are copied in bulk, but never past the end of the frame
+static void frameReadPayload(void)
+{
+    uint8_t i, n;
+
+    n = uartReadBuffer(frameBuffer + frameIdx, frameLen - frameIdx);
+    if (frameState == FRAME_PAYLOAD)
+        for (i = 0; i < n; i++)
+            frameChecksum ^= frameBuffer[frameIdx + i];
+    frameIdx += n;
+
+    if (frameIdx < frameLen)
+        return;
+    if (frameState == FRAME_PAYLOAD) {
+        frameState = FRAME_CHECKSUM;
+    } else {
+        frameState = FRAME_IDLE;
+        legacyProcessCommand();
+    }
+}
+
+// push subscribed groups that are due. Bytes are metered from serial_baudrate so the streams
+// can't fill txBuffer faster than the uart drains it. Groups take turns when the budget runs short.
+void serialTelemetry(void)
+{
+    uint32_t now = micros();
+    uint32_t elapsed = now - streamTime;
+    uint32_t maxBudget = 2 * (FRAME_BUFFER_SIZE + FRAME_OVERHEAD) * 1000000;
+    uint8_t i, cmd;
+    uint32_t cost;
+
+    streamTime = now;
+    if (cliMode)
+        return;
+
+    // 10 bits per byte on the wire
+    elapsed = min(elapsed, 100000);
+    streamBudget += elapsed * (cfg.serial_baudrate / 10 * STREAM_BANDWIDTH / 100);
+    if (streamBudget > maxBudget)
+        streamBudget = maxBudget;
+
+    for (i = 1; i < TLM_GROUPS; i++) {
+        cmd = (streamLast + i - 1) % (TLM_GROUPS - 1) + 1;
+        if (!streamRate[cmd] || (int32_t)(now - streamNext[cmd]) < 0)
+            continue;
+        frameBuildGroup(cmd);
+        cost = (frameTxIdx + FRAME_OVERHEAD) * 1000000;
+        // out of link budget or txBuffer space, the group stays due
+        if (cost > streamBudget || uartTxFree() < frameTxIdx + FRAME_OVERHEAD)
             break;
+        frameSend('>', cmd);
+        streamBudget -= cost;
+        streamLast = cmd;
+        streamNext[cmd] += 1000000 / streamRate[cmd];
+        // don't try to catch up after a stall, just restart the schedule
+        if ((int32_t)(now - streamNext[cmd]) > 0)
+            streamNext[cmd] = now + 1000000 / streamRate[cmd];
+    }
+}
+
+// single letter commands, and the start of framed and fixed size input
+static void serialCommand(uint8_t c)
+{
+    uint8_t i;
+
+    switch (c) {
+    case '$':              // start of a framed telemetry request
+        frameState = FRAME_HEADER_T;
+        break;
+    case '#':
+        cliProcess();
+        break;
+#ifdef BTSERIAL
+    case 'K':              // receive RC data from Bluetooth Serial adapter as a remote
+        legacyStart('K', BT_RC_SIZE);
+        break;
+#endif
+    case 'M':              // Multiwii @ arduino to GUI all data
+        serialize8('M');
+        serialize8(VERSION);        // MultiWii Firmware version
+        for (i = 0; i < 3; i++)
+            serialize16(accSmooth[i]);
+        for (i = 0; i < 3; i++)
+            serialize16(gyroData[i]);
+        for (i = 0; i < 3; i++)
+            serialize16(magADC[i]);
+        serialize16(EstAlt / 10);
+        serialize16(heading);       // compass
+        for (i = 0; i < 8; i++)
+            serialize16(servo[i]);
+        for (i = 0; i < 8; i++)
+            serialize16(motor[i]);
+        for (i = 0; i < 8; i++)
+            serialize16(rcData[i]);
+        serialize8(sensors(SENSOR_ACC) << 1 | sensors(SENSOR_BARO) << 2 | sensors(SENSOR_MAG) << 3 | sensors(SENSOR_GPS) << 4);
+        serialize8(accMode | baroMode << 1 | magMode << 2 | GPSModeHome << 3 | GPSModeHold << 4 | armed << 5);
+#if defined(LOG_VALUES)
+        serialize16(cycleTimeMax);
+        cycleTimeMax = 0;
+#else
+        serialize16(cycleTime);
+#endif
+        serialize16(i2cGetErrorCounter());
+        for (i = 0; i < 2; i++)
+            serialize16(angle[i]);
+        serialize8(cfg.mixerConfiguration);
+        for (i = 0; i < PIDITEMS; i++) {
+            serialize8(cfg.P8[i]);
+            serialize8(cfg.I8[i]);
+            serialize8(cfg.D8[i]);
+        }
+        serialize8(cfg.rcRate8);
+        serialize8(cfg.rcExpo8);
+        serialize8(cfg.rollPitchRate);
+        serialize8(cfg.yawRate);
+        serialize8(cfg.dynThrPID);
+        for (i = 0; i < CHECKBOXITEMS; i++) {
+            serialize8(cfg.activate[i][0]);
+            serialize8(cfg.activate[i][1] | (rcOptions[i] << 7)); // use highest bit to transport state in mwc
         }
+        serialize16(GPS_distanceToHome);
+        serialize16(GPS_directionToHome + 180);
+        serialize8(GPS_numSat);
+        serialize8(GPS_fix);
+        serialize8(GPS_update);
+        serialize16(0);                 // power meter, removed
+        serialize16(0);                 // power meter, removed
+        serialize8(vbat);
+        serialize16(BaroAlt / 10);      // 4 variables are here for general monitoring purpose
+        serialize16(debug2);            // debug2
+        serialize16(debug3);            // debug3
+        serialize16(debug4);            // debug4
+        serialize8('M');
+        break;
+    case 'O':              // arduino to OSD data - contribution from MIS
+        serialize8('O');
+        for (i = 0; i < 3; i++)
+            serialize16(accSmooth[i]);
+        for (i = 0; i < 3; i++)
+            serialize16(gyroData[i]);
+        serialize16(EstAlt * 10.0f);
+        serialize16(heading);       // compass - 16 bytes
+        for (i = 0; i < 2; i++)
+            serialize16(angle[i]);  //20
+        for (i = 0; i < 6; i++)
+            serialize16(motor[i]);  //32
+        for (i = 0; i < 6; i++) {
+            serialize16(rcData[i]);
+        }                   //44
+        serialize8(sensors(SENSOR_ACC) << 1 | sensors(SENSOR_BARO) << 2 | sensors(SENSOR_MAG) << 3 | sensors(SENSOR_GPS) << 4);
+        serialize8(accMode | baroMode << 1 | magMode << 2 | GPSModeHome << 3 | GPSModeHold << 4 | armed << 5);
+        serialize8(vbat);   // Vbatt 47
+        serialize8(VERSION);        // MultiWii Firmware version
+        serialize8(GPS_fix);        // Fix indicator for OSD
+        serialize8(GPS_numSat);
+        serialize16(GPS_latitude);
+        serialize16(GPS_latitude >> 16);
+        serialize16(GPS_longitude);
+        serialize16(GPS_longitude >> 16);
+        serialize16(GPS_altitude);
+        serialize16(GPS_speed);            // Speed for OSD
+        serialize8('O');    // NOT 49 anymore
+        break;
+    case 'L':              // stick to motor latency in us
+        serialize8('L');
+        serialize8(rcReceiverType);
+        serialize16(rcLatencyMin);
+        serialize16(rcLatencyAvg);
+        serialize16(rcLatencyMax);
+        serialize8('L');
+        break;
+    case 'R':               // reboot to bootloader (oops, apparently this w as used for other trash, fix later)
+        systemReset(true);
+        break;
+    case 'W':              //GUI write params to eeprom @ arduino, applied once all of it has arrived
+        legacyStart('W', GUI_WRITE_SIZE);
+        break;
+    case 'S':              // GUI to arduino ACC calibration request
+        calibratingA = 400;
+        break;
+    case 'E':              // GUI to arduino MAG calibration request
+        calibratingM = 1;
+        break;
+    }
+}
+
+void serialCom(void)
+{
+    uint32_t start = micros();
+
+    // in cli mode, all uart stuff goes to here. enter cli mode by sending #
+    if (cliMode) {
+        cliProcess();
+        return;
+    }
+
+    // host went quiet in the middle of a frame, drop it and look for the next command
+    if (frameState != FRAME_IDLE && start - frameByteTime > FRAME_TIMEOUT)
+        frameState = FRAME_IDLE;
+
+    // everything that is queued, until the budget runs out. '#' hands the rest over to the cli.
+    while (!cliMode && uartRxCount()) {
+        frameByteTime = micros();
+        if (frameByteTime - start > SERIAL_TIME_BUDGET)
+            break;
+
+        if (frameState == FRAME_PAYLOAD || frameState == FRAME_LEGACY)
+            frameReadPayload();
+        else if (frameState != FRAME_IDLE)
+            frameParse(uartRead());
+        else
+            serialCommand(uartRead());
     }
 }
@@ -3,15 +3,22 @@
 
 // driver for spektrum satellite receiver / sbus using UART2 (freeing up more motor outputs for stuff)
 
-#define SPEK_MAX_CHANNEL 7
+#define SPEK_MAX_CHANNEL 12             // DSMX 2048 sends up to 12 channels, spread over alternating frames
 #define SPEK_FRAME_SIZE 16
 static uint8_t spek_chan_shift;
 static uint8_t spek_chan_mask;
-static bool rcFrameComplete = false;
 static bool spekDataIncoming = false;
-volatile uint8_t spekFrame[SPEK_FRAME_SIZE];
+static uint8_t spekFrame[SPEK_FRAME_SIZE];
 
-static void spektrumDataReceive(uint16_t c);
+// Frames are decoded into the back buffer, then the buffers are swapped.
+// Readers only ever see a completely decoded set of channels.
+static volatile uint16_t spekChannelData[2][SPEK_MAX_CHANNEL];
+static volatile uint8_t spekActiveBuffer = 0;
+static volatile uint16_t spekFrameSeq = 0;      // number of frames decoded
+static volatile uint32_t spekFrameTime = 0;     // micros() at completion of the last frame
+static uint16_t spekFrameSeqSeen = 0;
+
+static void spektrumDataReceive(const uint8_t *data, uint16_t len, uint32_t idleTime);
 
 void spektrumInit(void)
 {
@@ -25,39 +32,73 @@ void spektrumInit(void)
         spek_chan_mask = 0x03;
     }
 
-    uart2Init(115200, spektrumDataReceive);
+    uart2Init(115200, spektrumDataReceive, UART_8N1);
+}
+
+static void spektrumDecodeFrame(void)
+{
+    uint8_t back = spekActiveBuffer ^ 1;
+    uint8_t b;
+
+    // frames with more than 7 channels only carry part of them, start from the previous set
+    for (b = 0; b < SPEK_MAX_CHANNEL; b++)
+        spekChannelData[back][b] = spekChannelData[spekActiveBuffer][b];
+
+    for (b = 3; b < SPEK_FRAME_SIZE; b += 2) {
+        uint8_t spekChannel = 0x0F & (spekFrame[b - 1] >> spek_chan_shift);
+        if (spekChannel < SPEK_MAX_CHANNEL)
+            spekChannelData[back][spekChannel] = ((uint16_t)(spekFrame[b - 1] & spek_chan_mask) << 8) + spekFrame[b];
+    }
+
+    spekActiveBuffer = back;
+    spekFrameSeq++;
 }
 
-// UART2 Receive ISR callback
-static void spektrumDataReceive(uint16_t c)
+// UART2 receive callback, from uart2Process(). The satellite sends a frame as one burst,
+// so the idle line after it is the end of the frame and its time is the frame time.
+static void spektrumDataReceive(const uint8_t *data, uint16_t len, uint32_t idleTime)
 {
-    uint32_t spekTime;
-    static uint32_t spekTimeLast, spekTimeInterval;
-    static uint8_t  spekFramePosition;
-
-    spekDataIncoming = true;
-    spekTime = micros();
-    spekTimeInterval = spekTime - spekTimeLast;
-    spekTimeLast = spekTime;
-    if (spekTimeInterval > 5000) 
-        spekFramePosition = 0;
-    spekFrame[spekFramePosition] = (uint8_t)c;
-    if (spekFramePosition == SPEK_FRAME_SIZE - 1) {
-        rcFrameComplete = true;
+    static uint8_t spekFramePosition;
+
+    for (; len; len--, data++) {
+        if (spekFramePosition < SPEK_FRAME_SIZE)
+            spekFrame[spekFramePosition] = *data;
+        // one past the frame size marks a burst that was too long
+        if (spekFramePosition <= SPEK_FRAME_SIZE)
+            spekFramePosition++;
+    }
+    if (!idleTime)
+        return;
+
+    // anything but exactly one frame between two idles is noise or a partial frame
+    if (spekFramePosition == SPEK_FRAME_SIZE) {
+        spekFrameTime = idleTime;
+        spektrumDecodeFrame();
+        spekDataIncoming = true;
 #if defined(FAILSAFE)
         if(failsafeCnt > 20) 
             failsafeCnt -= 20; 
         else 
             failsafeCnt = 0;   // clear FailSafe counter
 #endif
-    } else {
-        spekFramePosition++;
     }
+    spekFramePosition = 0;
 }
 
+// true once per newly decoded frame
 bool spektrumFrameComplete(void)
 {
-    return rcFrameComplete;
+    uint16_t seq = spekFrameSeq;
+
+    if (seq == spekFrameSeqSeen)
+        return false;
+    spekFrameSeqSeen = seq;
+    return true;
+}
+
+uint32_t spektrumFrameTime(void)
+{
+    return spekFrameTime;
 }
 
 // static const uint8_t spekRcChannelMap[SPEK_MAX_CHANNEL] = {1, 2, 3, 0, 4, 5, 6};
@@ -65,25 +106,15 @@ bool spektrumFrameComplete(void)
 uint16_t spektrumReadRawRC(uint8_t chan)
 {
     uint16_t data;
-    static uint32_t spekChannelData[SPEK_MAX_CHANNEL];
-    uint8_t b;
-
-    if (rcFrameComplete) {
-        for (b = 3; b < SPEK_FRAME_SIZE; b += 2) {
-            uint8_t spekChannel = 0x0F & (spekFrame[b - 1] >> spek_chan_shift);
-            if (spekChannel < SPEK_MAX_CHANNEL) 
-                spekChannelData[spekChannel] = ((uint32_t)(spekFrame[b - 1] & spek_chan_mask) << 8) + spekFrame[b];
-        }
-        rcFrameComplete = false;
-    }
 
-    if (chan >= SPEK_MAX_CHANNEL || !spekDataIncoming) {
+    if (chan >= SPEK_MAX_CHANNEL || cfg.rcmap[chan] >= SPEK_MAX_CHANNEL || !spekDataIncoming) {
         data = cfg.midrc;
     } else {
+        data = spekChannelData[spekActiveBuffer][cfg.rcmap[chan]];
         if (cfg.spektrum_hires)
-            data = 988 + (spekChannelData[cfg.rcmap[chan]] >> 1);   // 2048 mode
+            data = 988 + (data >> 1);   // 2048 mode
         else
-            data = 988 + spekChannelData[cfg.rcmap[chan]];          // 1024 mode
+            data = 988 + data;          // 1024 mode
     }
     
     return data;
@@ -0,0 +1,364 @@
+/*
+    bbdecode - decode and analyze blackbox logs recorded from the flight controller's serial port
+
+    usage: bbdecode [-c] [-q] [-j threads] log...
+        -c  write <log>.csv next to each log
+        -q  no per-file summary, only the fleet totals
+        -j  worker threads, default is one per core
+
+    Logs are mmapped and decoded in a single pass with fixed size state, so memory use doesn't grow
+    with log length. Many logs are spread over all cores, summaries are printed in command line order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bblog.h"
+
+#define HIST_BUCKET_US      250
+#define HIST_BUCKETS        40          // up to 10ms, the last bucket takes everything above
+#define STEP_MIN            30          // rcCommand change within one frame that counts as a step input
+#define STEP_WINDOW         128         // frames of gyro response recorded per step
+#define STEP_MIN_RESPONSE   20.0        // gyro units, smaller responses are too noisy to normalize
+
+typedef struct {
+    int64_t sum;
+    int32_t min, max;
+} fieldStats_t;
+
+typedef struct {
+    // one step at a time per axis, so this is all the state there is
+    int active;
+    int k;
+    int sign;
+    int32_t g0;
+    float resp[STEP_WINDOW];
+    // normalized average over all steps
+    double acc[STEP_WINDOW];
+    uint32_t steps;
+} stepState_t;
+
+typedef struct {
+    const char *path;
+    int error;
+    bbLog_t log;
+    int motorCount;                     // layout of the csv columns
+    uint32_t sessionStart;
+    int sessionOpen;
+    FILE *csv;
+    double duration;                    // s, sum over sessions
+    uint64_t frameIntervalSum, frameIntervalCount;
+    uint64_t hist[HIST_BUCKETS];
+    fieldStats_t stats[BB_MAX_FIELDS];
+    stepState_t step[3];
+} logResult_t;
+
+static int writeCsv = 0;
+static int quiet = 0;
+static logResult_t *results;
+static int resultCount;
+static volatile int nextResult = 0;
+
+static void logHeader(bbLog_t *log)
+{
+    static const char *base = "iteration,time,cycleTime,flags,gyroRoll,gyroPitch,gyroYaw,accX,accY,accZ,"
+        "rcRoll,rcPitch,rcYaw,rcThrottle,pRoll,pPitch,pYaw,iRoll,iPitch,iYaw,dRoll,dPitch,dYaw";
+    logResult_t *r = log->ctx;
+    int i;
+
+    // a new column header only when the layout changes
+    if (!r->csv || r->motorCount == log->motorCount)
+        return;
+    r->motorCount = log->motorCount;
+    fputs(base, r->csv);
+    for (i = 0; i < r->motorCount; i++)
+        fprintf(r->csv, ",motor%d", i);
+    fputc('\n', r->csv);
+}
+
+static void stepUpdate(stepState_t *s, int32_t rc, int32_t rcPrev, int32_t gyro, int32_t gyroPrev)
+{
+    int32_t delta = rc - rcPrev;
+    double final = 0;
+    int k;
+
+    if (s->active && abs(delta) >= STEP_MIN) {
+        // another input before the response settled, the window is contaminated
+        s->active = 0;
+    }
+
+    if (!s->active) {
+        if (abs(delta) >= STEP_MIN) {
+            s->active = 1;
+            s->k = 0;
+            s->sign = delta > 0 ? 1 : -1;
+            s->g0 = gyroPrev;
+        }
+        return;
+    }
+
+    s->resp[s->k++] = s->sign * (gyro - s->g0);
+    if (s->k < STEP_WINDOW)
+        return;
+    s->active = 0;
+
+    // normalize by where the response ended up, so only the shape is averaged
+    for (k = STEP_WINDOW * 3 / 4; k < STEP_WINDOW; k++)
+        final += s->resp[k];
+    final /= STEP_WINDOW - STEP_WINDOW * 3 / 4;
+    if (final < STEP_MIN_RESPONSE)
+        return;
+    for (k = 0; k < STEP_WINDOW; k++)
+        s->acc[k] += s->resp[k] / final;
+    s->steps++;
+}
+
+static void logFrame(bbLog_t *log, const int32_t *cur, const int32_t *prev, int havePrev)
+{
+    logResult_t *r = log->ctx;
+    uint32_t bucket;
+    int i;
+
+    if (!r->sessionOpen) {
+        r->sessionOpen = 1;
+        r->sessionStart = cur[F_TIME];
+    }
+
+    bucket = (uint32_t)cur[F_CYCLETIME] / HIST_BUCKET_US;
+    r->hist[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1]++;
+
+    for (i = 0; i < log->fieldCount; i++) {
+        fieldStats_t *f = &r->stats[i];
+        if (log->frames == 1 || cur[i] < f->min)
+            f->min = cur[i];
+        if (log->frames == 1 || cur[i] > f->max)
+            f->max = cur[i];
+        f->sum += cur[i];
+    }
+
+    if (havePrev) {
+        r->frameIntervalSum += (uint32_t)(cur[F_TIME] - prev[F_TIME]);
+        r->frameIntervalCount++;
+        for (i = 0; i < 3; i++)
+            stepUpdate(&r->step[i], cur[F_RC + i], prev[F_RC + i], cur[F_GYRO + i], prev[F_GYRO + i]);
+    }
+
+    if (r->csv) {
+        for (i = 0; i < log->fieldCount; i++)
+            fprintf(r->csv, i ? ",%d" : "%d", cur[i]);
+        fputc('\n', r->csv);
+    }
+}
+
+static void logSessionEnd(bbLog_t *log, const int32_t *last)
+{
+    logResult_t *r = log->ctx;
+
+    r->duration += (uint32_t)(last[F_TIME] - r->sessionStart) / 1e6;
+    r->sessionOpen = 0;
+}
+
+static void processLog(logResult_t *r)
+{
+    char csvPath[4096];
+
+    r->log.header = logHeader;
+    r->log.frame = logFrame;
+    r->log.sessionEnd = logSessionEnd;
+    r->log.ctx = r;
+    r->motorCount = -1;
+
+    if (writeCsv) {
+        snprintf(csvPath, sizeof(csvPath), "%s.csv", r->path);
+        r->csv = fopen(csvPath, "w");
+        if (!r->csv)
+            r->error = 2;
+    }
+
+    if (bbLogDecodeFile(r->path, &r->log) < 0)
+        r->error = 1;
+
+    if (r->csv)
+        fclose(r->csv);
+}
+
+static void *worker(void *arg)
+{
+    int i;
+
+    (void)arg;
+    while ((i = __sync_fetch_and_add(&nextResult, 1)) < resultCount)
+        processLog(&results[i]);
+    return NULL;
+}
+
+static void printStep(const char *axis, const stepState_t *s, double dt)
+{
+    double avg, peak = 0;
+    int k, k10 = -1, k90 = -1, settle = 0;
+
+    if (!s->steps) {
+        printf("  step %-5s  no usable steps\n", axis);
+        return;
+    }
+
+    for (k = 0; k < STEP_WINDOW; k++) {
+        avg = s->acc[k] / s->steps;
+        if (k10 < 0 && avg >= 0.1)
+            k10 = k;
+        if (k90 < 0 && avg >= 0.9)
+            k90 = k;
+        if (avg > peak)
+            peak = avg;
+        if (fabs(avg - 1.0) > 0.05)
+            settle = k + 1;
+    }
+
+    printf("  step %-5s  %u steps, rise 10-90%% ", axis, s->steps);
+    if (k10 >= 0 && k90 >= 0)
+        printf("%.1fms", (k90 - k10) * dt * 1000);
+    else
+        printf("n/a");
+    printf(", overshoot %.0f%%, settle 5%% %.1fms\n", (peak - 1.0) * 100, settle * dt * 1000);
+}
+
+static void printStats(const char *name, const logResult_t *r, int field)
+{
+    const fieldStats_t *f = &r->stats[field];
+
+    printf("  %-10s min %6d  avg %8.1f  max %6d\n", name, f->min, (double)f->sum / r->log.frames, f->max);
+}
+
+static void printResult(const logResult_t *r)
+{
+    static const char *axisNames[3] = { "roll", "pitch", "yaw" };
+    const bbLog_t *log = &r->log;
+    double dt = r->frameIntervalCount ? (double)r->frameIntervalSum / r->frameIntervalCount / 1e6 : 0;
+    uint64_t histMax = 0;
+    char name[16];
+    int i;
+
+    printf("== %s\n", r->path);
+    if (r->error == 1) {
+        printf("  can't read file\n");
+        return;
+    }
+    if (r->error == 2)
+        printf("  can't write csv\n");
+    printf("  %llu bytes, %u sessions, %llu frames (%u I, %u P), %llu garbage bytes, %u rejected frames\n",
+        (unsigned long long)log->bytes, log->sessions, (unsigned long long)log->frames, log->iFrames, log->pFrames,
+        (unsigned long long)log->garbage, log->rejected);
+    if (!log->frames)
+        return;
+    printf("  %.1fs logged, %d motors, every %d loops, %.0fHz frame rate\n", r->duration, log->motorCount, log->rateDiv,
+        dt > 0 ? 1 / dt : 0);
+
+    printStats("cycleTime", r, F_CYCLETIME);
+    for (i = 0; i < 3; i++) {
+        snprintf(name, sizeof(name), "gyro %s", axisNames[i]);
+        printStats(name, r, F_GYRO + i);
+    }
+    for (i = 0; i < log->motorCount; i++) {
+        snprintf(name, sizeof(name), "motor %d", i);
+        printStats(name, r, F_MOTOR + i);
+    }
+
+    printf("  loop time histogram:\n");
+    for (i = 0; i < HIST_BUCKETS; i++)
+        if (r->hist[i] > histMax)
+            histMax = r->hist[i];
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        int bar;
+        if (!r->hist[i])
+            continue;
+        bar = (int)(r->hist[i] * 40 / histMax);
+        if (i < HIST_BUCKETS - 1)
+            printf("  %5d-%5dus %10llu %5.1f%% ", i * HIST_BUCKET_US, (i + 1) * HIST_BUCKET_US,
+                (unsigned long long)r->hist[i], 100.0 * r->hist[i] / log->frames);
+        else
+            printf("  %5d+      us %10llu %5.1f%% ", i * HIST_BUCKET_US, (unsigned long long)r->hist[i],
+                100.0 * r->hist[i] / log->frames);
+        while (bar--)
+            putchar('#');
+        putchar('\n');
+    }
+
+    for (i = 0; i < 3; i++)
+        printStep(axisNames[i], &r->step[i], dt);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: bbdecode [-c] [-q] [-j threads] log...\n");
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t *threads;
+    uint64_t frames = 0, garbage = 0;
+    double duration = 0;
+    int threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    int ch, i, errors = 0;
+
+    while ((ch = getopt(argc, argv, "cqj:h")) != -1) {
+        switch (ch) {
+            case 'c':
+                writeCsv = 1;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            case 'j':
+                threadCount = atoi(optarg);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    resultCount = argc - optind;
+    if (resultCount <= 0) {
+        usage();
+        return 1;
+    }
+    if (threadCount < 1)
+        threadCount = 1;
+    if (threadCount > resultCount)
+        threadCount = resultCount;
+
+    results = calloc(resultCount, sizeof(logResult_t));
+    threads = calloc(threadCount, sizeof(pthread_t));
+    if (!results || !threads) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < resultCount; i++)
+        results[i].path = argv[optind + i];
+
+    for (i = 0; i < threadCount; i++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for (i = 0; i < threadCount; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < resultCount; i++) {
+        if (!quiet)
+            printResult(&results[i]);
+        errors += results[i].error != 0;
+        frames += results[i].log.frames;
+        garbage += results[i].log.garbage;
+        duration += results[i].duration;
+    }
+    if (resultCount > 1 || quiet)
+        printf("== %d logs, %llu frames, %.1fs logged, %llu garbage bytes, %d errors\n", resultCount,
+            (unsigned long long)frames, duration, (unsigned long long)garbage, errors);
+
+    free(threads);
+    free(results);
+    return errors ? 1 : 0;
+}
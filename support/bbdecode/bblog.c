@@ -0,0 +1,163 @@
+/*
+    bblog - blackbox log decoder shared by the host tools
+
+    Garbage in the capture (CLI text, line noise, frames cut short by a dropped byte) is skipped
+    one byte at a time until the next header or keyframe, so a damaged log still decodes.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bblog.h"
+
+// returns the byte after the varint, NULL when truncated or longer than a 32bit value
+static const uint8_t *readSignedVB(const uint8_t *p, const uint8_t *end, int32_t *value)
+{
+    uint32_t v = 0;
+    int shift;
+
+    for (shift = 0; shift < 35; shift += 7) {
+        if (p >= end)
+            return NULL;
+        v |= (uint32_t)(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80)) {
+            *value = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static const uint8_t *readFrame(const uint8_t *p, const uint8_t *end, int count, int32_t *values)
+{
+    int i;
+
+    for (i = 0; i < count && p; i++)
+        p = readSignedVB(p, end, &values[i]);
+    return p;
+}
+
+static void endSession(bbLog_t *log)
+{
+    if (log->sessionOpen && log->sessionEnd)
+        log->sessionEnd(log, log->cur);
+    log->sessionOpen = 0;
+}
+
+static void emitFrame(bbLog_t *log, const int32_t *prev, int havePrev)
+{
+    log->frames++;
+    log->sessionOpen = 1;
+    if (log->frame)
+        log->frame(log, log->cur, prev, havePrev);
+}
+
+void bbLogDecode(bbLog_t *log, const uint8_t *p, const uint8_t *end)
+{
+    int32_t values[BB_MAX_FIELDS], prev[BB_MAX_FIELDS];
+    const uint8_t *q;
+    int i, havePrev;
+
+    while (p < end) {
+        switch (*p) {
+            case 'H':
+                if (end - p >= 5 && p[1] == BB_VERSION && p[3] <= BB_MAX_MOTORS && p[2] == BB_BASE_FIELDS + p[3] && p[4] >= 1) {
+                    endSession(log);
+                    log->fieldCount = p[2];
+                    log->motorCount = p[3];
+                    log->rateDiv = p[4];
+                    log->haveHeader = 1;
+                    log->haveKey = 0;
+                    log->sessions++;
+                    if (log->header)
+                        log->header(log);
+                    p += 5;
+                    continue;
+                }
+                break;
+
+            case 'I':
+                if (!log->haveHeader)
+                    break;
+                q = readFrame(p + 1, end, log->fieldCount, values);
+                // iteration always lands on the rate divider, that rules out most false syncs
+                if (!q || values[F_ITERATION] < 0 || values[F_ITERATION] % log->rateDiv)
+                    break;
+                havePrev = log->haveKey && values[F_ITERATION] > log->cur[F_ITERATION];
+                memcpy(prev, log->cur, sizeof(prev));
+                memcpy(log->cur, values, sizeof(int32_t) * log->fieldCount);
+                log->haveKey = 1;
+                log->iFrames++;
+                emitFrame(log, prev, havePrev);
+                p = q;
+                continue;
+
+            case 'P':
+                if (!log->haveKey)
+                    break;
+                q = readFrame(p + 1, end, log->fieldCount, values);
+                // logged every rateDiv loops, anything else is a false sync on garbage
+                if (!q || values[F_ITERATION] != log->rateDiv) {
+                    log->rejected++;
+                    break;
+                }
+                memcpy(prev, log->cur, sizeof(prev));
+                for (i = 0; i < log->fieldCount; i++)
+                    log->cur[i] += values[i];
+                log->pFrames++;
+                emitFrame(log, prev, 1);
+                p = q;
+                continue;
+
+            case 'E':
+                if (log->haveKey) {
+                    endSession(log);
+                    log->haveKey = 0;
+                    p++;
+                    continue;
+                }
+                break;
+        }
+        // not a frame start we can use, resync on the next byte
+        log->garbage++;
+        p++;
+    }
+
+    endSession(log);
+}
+
+int bbLogDecodeFile(const char *path, bbLog_t *log)
+{
+    struct stat st;
+    const uint8_t *data;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    log->bytes = st.st_size;
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+    // pages behind the decoder can be dropped, so resident memory stays flat on long logs
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+    bbLogDecode(log, data, data + st.st_size);
+
+    munmap((void *)data, st.st_size);
+    return 0;
+}
@@ -0,0 +1,59 @@
+/*
+    bblog - blackbox log decoder shared by the host tools
+
+    The format is written by src/blackbox.c, keep the two in sync:
+    'H' version fieldCount motorCount rateDiv, then 'I' (absolute) or 'P' (delta) frames with
+    fieldCount zigzag varints each, 'E' when the board disarms.
+*/
+
+#ifndef BBLOG_H
+#define BBLOG_H
+
+#include <stdint.h>
+
+#define BB_VERSION          1
+#define BB_BASE_FIELDS      23
+#define BB_MAX_MOTORS       8
+#define BB_MAX_FIELDS       (BB_BASE_FIELDS + BB_MAX_MOTORS)
+
+// field index, same order as collectFields() in src/blackbox.c
+enum {
+    F_ITERATION = 0,
+    F_TIME,
+    F_CYCLETIME,
+    F_FLAGS,
+    F_GYRO,                             // roll, pitch, yaw
+    F_ACC = F_GYRO + 3,
+    F_RC = F_ACC + 3,                   // roll, pitch, yaw, throttle
+    F_P = F_RC + 4,
+    F_I = F_P + 3,
+    F_D = F_I + 3,
+    F_MOTOR = F_D + 3
+};
+
+typedef struct bbLog_t {
+    // header of the current session
+    int fieldCount;
+    int motorCount;
+    int rateDiv;
+
+    // decoder counters
+    uint64_t bytes, garbage, frames;
+    uint32_t sessions, iFrames, pFrames, rejected;
+
+    // all optional. prev is only valid when havePrev is set.
+    void (*header)(struct bbLog_t *log);
+    void (*frame)(struct bbLog_t *log, const int32_t *cur, const int32_t *prev, int havePrev);
+    void (*sessionEnd)(struct bbLog_t *log, const int32_t *last);
+    void *ctx;
+
+    // decoder state
+    int haveHeader, haveKey, sessionOpen;
+    int32_t cur[BB_MAX_FIELDS];
+} bbLog_t;
+
+// mmaps the file and decodes it in a single pass, returns -1 if it can't be read
+int bbLogDecodeFile(const char *path, bbLog_t *log);
+void bbLogDecode(bbLog_t *log, const uint8_t *p, const uint8_t *end);
+
+#endif
@@ -0,0 +1,625 @@
+/*
+    gyrospec - gyro noise spectra from blackbox logs, for choosing gyro filter settings
+
+    usage: gyrospec [-c] [-n fftsize] [-m minhz] [-j threads] log...
+        -c  write <log>.spectrum.csv next to each log
+        -n  FFT size, power of two from 64 to 4096, default 256
+        -m  lowest noise frequency to consider for the notch, default 80 like notch_min_hz
+        -j  worker threads, default is one per core
+
+    Each axis is cut into hann windowed, 50% overlapping segments and averaged into a power
+    spectrum per throttle band (Welch's method). The spectra give the noise peak per axis and
+    how it moves with throttle, from which gyro_lpf, gyro_smoothing_factor, notch_min_hz and
+    notch_q are suggested.
+
+    The log has gyroData after the filters that were active in flight, and only every
+    blackbox_rate_div'th loop. For a clean picture record with blackbox_rate_div = 1 and the
+    GYRO_SMOOTHING and DYNAMIC_NOTCH features off.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bblog.h"
+
+#define FFT_MAX_LOG2        12
+#define THROTTLE_BINS       10          // rcCommand throttle 1000..2000 in steps of 100
+#define THROTTLE_MIN        1000
+#define THROTTLE_STEP       100
+#define MIN_WINDOWS         4           // throttle bands with fewer windows are too noisy to report
+#define SIGNAL_HZ           20          // below this it's mostly stick input, not noise
+#define PEAK_RATIO          4           // peak has to be this far above the median floor, same as src/notch.c
+
+typedef struct {
+    int n, log2;
+    float *window;
+    double windowPower;                 // sum of window^2, for PSD scaling
+    int *bitRev;
+    // per stage twiddles stored back to back, stage s starts at (1 << s) - 1 so the
+    // butterfly loop reads them contiguously and the compiler can vectorize it
+    float *twRe, *twIm;
+} fftPlan_t;
+
+typedef struct {
+    float peakHz, peakDb, floorDb;      // peakHz 0 = no clear peak
+    float q;
+    float lowestNoiseHz;                // lowest significant peak above SIGNAL_HZ, 0 = none
+    float throttlePeakHz[THROTTLE_BINS];
+} axisResult_t;
+
+typedef struct {
+    const char *path;
+    int error;
+    bbLog_t log;
+    double logHz, loopHz;
+    uint32_t windows[THROTTLE_BINS];
+    uint32_t totalWindows, skippedSessions;
+    axisResult_t axis[3];
+} specResult_t;
+
+// analysis state, lives only while a worker decodes one log
+typedef struct {
+    specResult_t *r;
+    int rateDiv;                        // of the first session, others would mix sample rates
+    int skipSession;
+    float ring[3][1 << FFT_MAX_LOG2];
+    float throttleRing[1 << FFT_MAX_LOG2];
+    int pos, fill, sinceFft;
+    uint64_t intervalSum, intervalCount;
+    uint64_t cycleSum, cycleCount;
+    double *psd;                        // [axis][throttle][bin]
+    float re[1 << FFT_MAX_LOG2], im[1 << FFT_MAX_LOG2];
+} spectrum_t;
+
+static fftPlan_t plan;
+static int writeCsv = 0;
+static int minHz = 80;
+static specResult_t *results;
+static int resultCount;
+static volatile int nextResult = 0;
+
+static const char *axisNames[3] = { "roll", "pitch", "yaw" };
+
+static int fftPlanInit(fftPlan_t *p, int log2)
+{
+    int i, b, s;
+
+    p->log2 = log2;
+    p->n = 1 << log2;
+    p->window = malloc(p->n * sizeof(float));
+    p->bitRev = malloc(p->n * sizeof(int));
+    p->twRe = malloc(p->n * sizeof(float));
+    p->twIm = malloc(p->n * sizeof(float));
+    if (!p->window || !p->bitRev || !p->twRe || !p->twIm)
+        return -1;
+
+    p->windowPower = 0;
+    for (i = 0; i < p->n; i++) {
+        p->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / (p->n - 1));
+        p->windowPower += p->window[i] * p->window[i];
+        p->bitRev[i] = 0;
+        for (b = 0; b < log2; b++)
+            if (i & (1 << b))
+                p->bitRev[i] |= 1 << (log2 - 1 - b);
+    }
+
+    for (s = 0; s < log2; s++) {
+        int half = 1 << s;
+        for (i = 0; i < half; i++) {
+            p->twRe[half - 1 + i] = cos(M_PI * i / half);
+            p->twIm[half - 1 + i] = -sin(M_PI * i / half);
+        }
+    }
+    return 0;
+}
+
+// in place radix-2 decimation in time, input has to be in bit reversed order
+static void fft(const fftPlan_t *p, float *re, float *im)
+{
+    int s, i, k;
+
+    for (s = 0; s < p->log2; s++) {
+        int half = 1 << s;
+        const float *wr = p->twRe + half - 1;
+        const float *wi = p->twIm + half - 1;
+        for (i = 0; i < p->n; i += half * 2) {
+            float *restrict ar = re + i, *restrict ai = im + i;
+            float *restrict br = re + i + half, *restrict bi = im + i + half;
+            for (k = 0; k < half; k++) {
+                float tr = wr[k] * br[k] - wi[k] * bi[k];
+                float ti = wr[k] * bi[k] + wi[k] * br[k];
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+}
+
+static int throttleBin(float throttle)
+{
+    int bin = (throttle - THROTTLE_MIN) / THROTTLE_STEP;
+
+    return bin < 0 ? 0 : bin >= THROTTLE_BINS ? THROTTLE_BINS - 1 : bin;
+}
+
+static void analyzeWindow(spectrum_t *sp)
+{
+    int bins = plan.n / 2 + 1;
+    double throttle = 0;
+    int axis, i, t;
+
+    for (i = 0; i < plan.n; i++)
+        throttle += sp->throttleRing[i];
+    t = throttleBin(throttle / plan.n);
+
+    for (axis = 0; axis < 3; axis++) {
+        double *psd = sp->psd + (axis * THROTTLE_BINS + t) * bins;
+        float mean = 0;
+
+        // oldest sample first, DC removed so slow stick motion doesn't leak into the low bins
+        for (i = 0; i < plan.n; i++)
+            mean += sp->ring[axis][i];
+        mean /= plan.n;
+        for (i = 0; i < plan.n; i++) {
+            int idx = plan.bitRev[i];
+            sp->re[idx] = (sp->ring[axis][(sp->pos + i) & (plan.n - 1)] - mean) * plan.window[i];
+            sp->im[idx] = 0;
+        }
+
+        fft(&plan, sp->re, sp->im);
+
+        for (i = 0; i < bins; i++)
+            psd[i] += (double)sp->re[i] * sp->re[i] + (double)sp->im[i] * sp->im[i];
+    }
+
+    sp->r->windows[t]++;
+    sp->r->totalWindows++;
+}
+
+static void logHeader(bbLog_t *log)
+{
+    spectrum_t *sp = log->ctx;
+
+    if (!sp->rateDiv)
+        sp->rateDiv = log->rateDiv;
+    sp->skipSession = log->rateDiv != sp->rateDiv;
+    if (sp->skipSession)
+        sp->r->skippedSessions++;
+    sp->fill = 0;
+}
+
+static void logFrame(bbLog_t *log, const int32_t *cur, const int32_t *prev, int havePrev)
+{
+    spectrum_t *sp = log->ctx;
+    int axis;
+
+    if (sp->skipSession)
+        return;
+
+    sp->cycleSum += cur[F_CYCLETIME];
+    sp->cycleCount++;
+
+    // segments have to be evenly sampled, start over after a dropped frame
+    if (!havePrev || cur[F_ITERATION] - prev[F_ITERATION] != log->rateDiv) {
+        sp->fill = 0;
+    } else {
+        sp->intervalSum += (uint32_t)(cur[F_TIME] - prev[F_TIME]);
+        sp->intervalCount++;
+    }
+    if (sp->fill == 0)
+        sp->sinceFft = 0;
+
+    for (axis = 0; axis < 3; axis++)
+        sp->ring[axis][sp->pos] = cur[F_GYRO + axis];
+    sp->throttleRing[sp->pos] = cur[F_RC + 3];
+    sp->pos = (sp->pos + 1) & (plan.n - 1);
+    if (sp->fill < plan.n)
+        sp->fill++;
+    sp->sinceFft++;
+
+    if (sp->fill == plan.n && sp->sinceFft >= plan.n / 2) {
+        analyzeWindow(sp);
+        sp->sinceFft = 0;
+    }
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// windows accumulated as |X|^2, scaled to a one sided power spectral density in units^2/Hz
+static void scalePsd(double *out, const double *raw, int bins, uint32_t windows, double logHz)
+{
+    double scale = 1.0 / (logHz * plan.windowPower * windows);
+    int i;
+
+    for (i = 0; i < bins; i++)
+        out[i] = raw[i] * scale * (i > 0 && i < bins - 1 ? 2 : 1);
+}
+
+static double medianFloor(const double *psd, int from, int bins, double *tmp)
+{
+    int n = bins - from;
+
+    if (n <= 0)
+        return 0;
+    memcpy(tmp, psd + from, n * sizeof(double));
+    qsort(tmp, n, sizeof(double), compareDouble);
+    return tmp[n / 2];
+}
+
+// strongest bin from minBin up, if it stands out of the floor. returns the bin or 0.
+static int findPeak(const double *psd, int minBin, int bins, double floor)
+{
+    int i, peak = 0;
+
+    for (i = minBin; i < bins; i++)
+        if (!peak || psd[i] > psd[peak])
+            peak = i;
+    if (!peak || psd[peak] < PEAK_RATIO * floor)
+        return 0;
+    return peak;
+}
+
+// centroid of the peak and its neighbours for sub-bin resolution
+static float peakHz(const double *psd, int peak, int bins, double binHz)
+{
+    double sum, weighted;
+
+    if (peak < 1 || peak >= bins - 1)
+        return peak * binHz;
+    sum = psd[peak - 1] + psd[peak] + psd[peak + 1];
+    weighted = psd[peak - 1] * (peak - 1) + psd[peak] * peak + psd[peak + 1] * (peak + 1);
+    return weighted / sum * binHz;
+}
+
+static void summarize(spectrum_t *sp, FILE *csv)
+{
+    specResult_t *r = sp->r;
+    int bins = plan.n / 2 + 1;
+    double *psd = malloc(bins * sizeof(double));
+    double *band = malloc(bins * sizeof(double));
+    double *tmp = malloc(bins * sizeof(double));
+    double binHz, floor;
+    int axis, t, i, signalBin, minBin, peak;
+
+    if (!psd || !band || !tmp) {
+        r->error = 1;
+        goto done;
+    }
+
+    r->loopHz = sp->cycleCount ? 1e6 * sp->cycleCount / sp->cycleSum : 0;
+    r->logHz = sp->intervalCount ? 1e6 * sp->intervalCount / sp->intervalSum : 0;
+    if (!r->totalWindows || r->logHz <= 0)
+        goto done;
+
+    binHz = r->logHz / plan.n;
+    signalBin = ceil(SIGNAL_HZ / binHz);
+    if (signalBin < 1)
+        signalBin = 1;
+    minBin = ceil(minHz / binHz);
+    if (minBin < signalBin)
+        minBin = signalBin;
+
+    if (csv)
+        fprintf(csv, "axis,throttleLow,throttleHigh,hz,psdDb\n");
+
+    for (axis = 0; axis < 3; axis++) {
+        axisResult_t *a = &r->axis[axis];
+        const double *raw = sp->psd + axis * THROTTLE_BINS * bins;
+
+        // all throttle bands together
+        memset(band, 0, bins * sizeof(double));
+        for (t = 0; t < THROTTLE_BINS; t++)
+            for (i = 0; i < bins; i++)
+                band[i] += raw[t * bins + i];
+        scalePsd(psd, band, bins, r->totalWindows, r->logHz);
+
+        floor = medianFloor(psd, signalBin, bins, tmp);
+        a->floorDb = 10 * log10(floor + 1e-12);
+
+        peak = findPeak(psd, minBin, bins, floor);
+        if (peak) {
+            int lo = peak, hi = peak;
+            a->peakHz = peakHz(psd, peak, bins, binHz);
+            a->peakDb = 10 * log10(psd[peak] + 1e-12);
+            // width at half power gives the notch quality factor
+            while (lo > 0 && psd[lo - 1] > psd[peak] / 2)
+                lo--;
+            while (hi < bins - 1 && psd[hi + 1] > psd[peak] / 2)
+                hi++;
+            a->q = a->peakHz / ((hi - lo + 1) * binHz);
+        }
+
+        for (i = signalBin; i < bins - 1; i++) {
+            if (psd[i] >= psd[i - 1] && psd[i] >= psd[i + 1] && psd[i] >= PEAK_RATIO * floor) {
+                a->lowestNoiseHz = peakHz(psd, i, bins, binHz);
+                break;
+            }
+        }
+
+        if (csv)
+            for (i = 0; i < bins; i++)
+                fprintf(csv, "%s,%d,%d,%.2f,%.2f\n", axisNames[axis], THROTTLE_MIN, THROTTLE_MIN + THROTTLE_BINS * THROTTLE_STEP,
+                    i * binHz, 10 * log10(psd[i] + 1e-12));
+
+        for (t = 0; t < THROTTLE_BINS; t++) {
+            if (r->windows[t] < MIN_WINDOWS)
+                continue;
+            scalePsd(psd, raw + t * bins, bins, r->windows[t], r->logHz);
+            floor = medianFloor(psd, signalBin, bins, tmp);
+            peak = findPeak(psd, minBin, bins, floor);
+            if (peak)
+                a->throttlePeakHz[t] = peakHz(psd, peak, bins, binHz);
+            if (csv)
+                for (i = 0; i < bins; i++)
+                    fprintf(csv, "%s,%d,%d,%.2f,%.2f\n", axisNames[axis], THROTTLE_MIN + t * THROTTLE_STEP,
+                        THROTTLE_MIN + (t + 1) * THROTTLE_STEP, i * binHz, 10 * log10(psd[i] + 1e-12));
+        }
+    }
+
+done:
+    free(psd);
+    free(band);
+    free(tmp);
+}
+
+static void processLog(specResult_t *r)
+{
+    spectrum_t *sp = calloc(1, sizeof(spectrum_t));
+    char csvPath[4096];
+    FILE *csv = NULL;
+
+    if (sp)
+        sp->psd = calloc(3 * THROTTLE_BINS * (plan.n / 2 + 1), sizeof(double));
+    if (!sp || !sp->psd) {
+        r->error = 1;
+        free(sp);
+        return;
+    }
+    sp->r = r;
+
+    r->log.header = logHeader;
+    r->log.frame = logFrame;
+    r->log.ctx = sp;
+
+    if (bbLogDecodeFile(r->path, &r->log) < 0) {
+        r->error = 1;
+    } else {
+        if (writeCsv) {
+            snprintf(csvPath, sizeof(csvPath), "%s.spectrum.csv", r->path);
+            csv = fopen(csvPath, "w");
+            if (!csv)
+                r->error = 2;
+        }
+        summarize(sp, csv);
+        if (csv)
+            fclose(csv);
+    }
+
+    free(sp->psd);
+    free(sp);
+}
+
+static void *worker(void *arg)
+{
+    int i;
+
+    (void)arg;
+    while ((i = __sync_fetch_and_add(&nextResult, 1)) < resultCount)
+        processLog(&results[i]);
+    return NULL;
+}
+
+// IIR step of imu.c, y += (x - y) / factor per loop, pick the factor with a cutoff of hz
+static int smoothingFactor(float hz, double loopHz)
+{
+    double factor;
+
+    if (hz <= 0 || loopHz <= 0)
+        return 1;
+    factor = 1.0 / (1.0 - exp(-2 * M_PI * hz / loopHz));
+    return factor < 1 ? 1 : factor > 255 ? 255 : (int)(factor + 0.5);
+}
+
+static void printRecommendation(const specResult_t *r)
+{
+    static const int lpfOptions[] = { 256, 188, 98, 42, 20, 10 };
+    float cutoff = 0, notchLow = 0, q = 0;
+    int smoothing[3];
+    int axis, t, i, lpf, tracking = 0;
+
+    for (axis = 0; axis < 3; axis++) {
+        const axisResult_t *a = &r->axis[axis];
+        float lo = 0, hi = 0;
+
+        // about an octave below the first noise peak
+        if (a->lowestNoiseHz && (!cutoff || a->lowestNoiseHz / 2 < cutoff))
+            cutoff = a->lowestNoiseHz / 2;
+
+        if (a->peakHz) {
+            if (!notchLow || a->peakHz < notchLow)
+                notchLow = a->peakHz;
+            if (!q || a->q < q)
+                q = a->q;
+        }
+        for (t = 0; t < THROTTLE_BINS; t++) {
+            float hz = a->throttlePeakHz[t];
+            if (!hz)
+                continue;
+            if (!lo || hz < lo)
+                lo = hz;
+            if (hz > hi)
+                hi = hz;
+        }
+        if (lo && hi > lo * 1.25f)
+            tracking = 1;
+        if (lo && lo < notchLow)
+            notchLow = lo;
+    }
+
+    if (cutoff) {
+        // the smoothing feature covers all axes, quiet ones get the overall cutoff
+        for (axis = 0; axis < 3; axis++)
+            smoothing[axis] = smoothingFactor(r->axis[axis].lowestNoiseHz ? r->axis[axis].lowestNoiseHz / 2 : cutoff, r->loopHz);
+        lpf = lpfOptions[sizeof(lpfOptions) / sizeof(lpfOptions[0]) - 1];
+        for (i = 0; i < (int)(sizeof(lpfOptions) / sizeof(lpfOptions[0])); i++) {
+            if (lpfOptions[i] <= cutoff) {
+                lpf = lpfOptions[i];
+                break;
+            }
+        }
+        printf("  suggest: gyro_lpf = %d (mpu3050), or GYRO_SMOOTHING with gyro_smoothing_factor = 0x%08X\n", lpf,
+            smoothing[0] << 16 | smoothing[1] << 8 | smoothing[2]);
+    } else {
+        printf("  suggest: no noise above the floor, gyro_lpf can stay\n");
+    }
+
+    if (notchLow) {
+        int minHzSetting = notchLow * 0.8f;
+        int qSetting = q * 10;
+        minHzSetting = minHzSetting < 20 ? 20 : minHzSetting > 500 ? 500 : minHzSetting;
+        qSetting = qSetting < 5 ? 5 : qSetting > 100 ? 100 : qSetting;
+        printf("  suggest: DYNAMIC_NOTCH with notch_min_hz = %d, notch_q = %d%s\n", minHzSetting, qSetting,
+            tracking ? " (peak moves with throttle)" : "");
+    }
+}
+
+static void printResult(const specResult_t *r)
+{
+    const bbLog_t *log = &r->log;
+    int axis, t;
+
+    printf("== %s\n", r->path);
+    if (r->error == 1) {
+        printf("  can't read file\n");
+        return;
+    }
+    if (r->error == 2)
+        printf("  can't write csv\n");
+    printf("  %llu frames, %u sessions", (unsigned long long)log->frames, log->sessions);
+    if (r->skippedSessions)
+        printf(" (%u skipped, different blackbox_rate_div)", r->skippedSessions);
+    printf(", %u windows of %d\n", r->totalWindows, plan.n);
+    if (!r->totalWindows) {
+        printf("  not enough continuous frames for one window\n");
+        return;
+    }
+    printf("  log rate %.0fHz resolves up to %.0fHz, %.1fHz per bin, loop rate %.0fHz\n", r->logHz, r->logHz / 2,
+        r->logHz / plan.n, r->loopHz);
+    if (r->logHz / 2 < r->loopHz / 2 * 0.9)
+        printf("  noise between %.0fHz and %.0fHz folds back into the spectrum, record with blackbox_rate_div = 1\n",
+            r->logHz / 2, r->loopHz / 2);
+
+    printf("  windows by throttle:");
+    for (t = 0; t < THROTTLE_BINS; t++)
+        if (r->windows[t])
+            printf(" %d:%u", THROTTLE_MIN + t * THROTTLE_STEP, r->windows[t]);
+    printf("\n");
+
+    for (axis = 0; axis < 3; axis++) {
+        const axisResult_t *a = &r->axis[axis];
+
+        printf("  %-5s floor %6.1fdB", axisNames[axis], a->floorDb);
+        if (a->peakHz)
+            printf(", peak %6.1fHz %+6.1fdB Q %.1f", a->peakHz, a->peakDb - a->floorDb, a->q);
+        else
+            printf(", no peak above %dHz", minHz);
+        if (a->lowestNoiseHz)
+            printf(", noise from %.1fHz", a->lowestNoiseHz);
+        printf("\n");
+
+        if (!a->peakHz)
+            continue;
+        printf("        peak by throttle:");
+        for (t = 0; t < THROTTLE_BINS; t++)
+            if (a->throttlePeakHz[t])
+                printf(" %d:%.0fHz", THROTTLE_MIN + t * THROTTLE_STEP, a->throttlePeakHz[t]);
+        printf("\n");
+    }
+
+    printRecommendation(r);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: gyrospec [-c] [-n fftsize] [-m minhz] [-j threads] log...\n");
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t *threads;
+    int threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    int fftSize = 256, log2 = 0;
+    int ch, i, errors = 0;
+
+    while ((ch = getopt(argc, argv, "cn:m:j:h")) != -1) {
+        switch (ch) {
+            case 'c':
+                writeCsv = 1;
+                break;
+            case 'n':
+                fftSize = atoi(optarg);
+                break;
+            case 'm':
+                minHz = atoi(optarg);
+                break;
+            case 'j':
+                threadCount = atoi(optarg);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    while ((1 << log2) < fftSize)
+        log2++;
+    if ((1 << log2) != fftSize || log2 < 6 || log2 > FFT_MAX_LOG2) {
+        fprintf(stderr, "FFT size has to be a power of two from 64 to %d\n", 1 << FFT_MAX_LOG2);
+        return 1;
+    }
+
+    resultCount = argc - optind;
+    if (resultCount <= 0) {
+        usage();
+        return 1;
+    }
+    if (threadCount < 1)
+        threadCount = 1;
+    if (threadCount > resultCount)
+        threadCount = resultCount;
+
+    results = calloc(resultCount, sizeof(specResult_t));
+    threads = calloc(threadCount, sizeof(pthread_t));
+    if (!results || !threads || fftPlanInit(&plan, log2) < 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < resultCount; i++)
+        results[i].path = argv[optind + i];
+
+    for (i = 0; i < threadCount; i++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for (i = 0; i < threadCount; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < resultCount; i++) {
+        printResult(&results[i]);
+        errors += results[i].error != 0;
+    }
+
+    free(threads);
+    free(results);
+    return errors ? 1 : 0;
+}
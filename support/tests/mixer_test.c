@@ -0,0 +1,243 @@
+/*
+    mixer_test - host check of the Q8 mixer tables against the PIDMIX expressions they replaced
+
+    Runs mixerInit()/mixTable() from src/mixer.c for every built-in geometry and both yaw
+    directions over a grid of throttle and PID values, and compares each motor output with the
+    old integer expressions. The only allowed difference is rounding, see MIX_TOLERANCE.
+*/
+
+#include "../../src/mixer.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// mixer.c links against these
+config_t cfg;
+int16_t angle[2];
+int16_t axisPID[3];
+int16_t rcCommand[4];
+int16_t rcData[RC_CHANS];
+uint8_t rcOptions[CHECKBOXITEMS];
+uint8_t armed = 1;
+uint8_t passThruMode = 0;
+
+bool feature(uint32_t mask) { (void)mask; return false; }
+uint32_t millis(void) { return 0; }
+void pwmWrite(uint8_t channel, uint16_t value) { (void)channel; (void)value; }
+void pwmCompleteMotorUpdate(void) { }
+
+// the old code truncates each fractional term towards zero, the new one rounds the coefficients
+// to Q8 (off by at most 0.0013, 0.4 at a PID of 300) and floors the sum once
+#define MIX_TOLERANCE 2
+
+#define PIDMIX(X,Y,Z) rcCommand[THROTTLE] + axisPID[ROLL] * X + axisPID[PITCH] * Y + cfg.yaw_direction * axisPID[YAW] * Z
+
+static int16_t oldMotor[MAX_MOTORS];
+static uint32_t checks = 0, failures = 0;
+static int maxDiff = 0;
+
+// motor counts of the old mixerInit(), AIRPLANE and HELI fell through and kept 4
+static uint8_t oldNumberMotor(uint8_t type)
+{
+    switch (type) {
+        case MULTITYPE_GIMBAL:
+            return 0;
+        case MULTITYPE_FLYING_WING:
+            return 1;
+        case MULTITYPE_BI:
+            return 2;
+        case MULTITYPE_TRI:
+            return 3;
+        case MULTITYPE_Y6:
+        case MULTITYPE_HEX6:
+        case MULTITYPE_HEX6X:
+            return 6;
+        case MULTITYPE_OCTOX8:
+        case MULTITYPE_OCTOFLATP:
+        case MULTITYPE_OCTOFLATX:
+            return 8;
+    }
+    return 4;
+}
+
+// motor part of the old mixTable() switch, verbatim apart from the output array
+static void oldMix(void)
+{
+    int16_t *motor = oldMotor;
+
+    switch (cfg.mixerConfiguration) {
+        case MULTITYPE_BI:
+            motor[0] = PIDMIX(+1, 0, 0);        //LEFT
+            motor[1] = PIDMIX(-1, 0, 0);        //RIGHT
+            break;
+
+        case MULTITYPE_TRI:
+            motor[0] = PIDMIX(0, +4 / 3, 0);    //REAR
+            motor[1] = PIDMIX(-1, -2 / 3, 0);   //RIGHT
+            motor[2] = PIDMIX(+1, -2 / 3, 0);   //LEFT
+            break;
+
+        case MULTITYPE_QUADP:
+            motor[0] = PIDMIX(0, +1, -1);       //REAR
+            motor[1] = PIDMIX(-1, 0, +1);       //RIGHT
+            motor[2] = PIDMIX(+1, 0, +1);       //LEFT
+            motor[3] = PIDMIX(0, -1, -1);       //FRONT
+            break;
+
+        case MULTITYPE_QUADX:
+            motor[0] = PIDMIX(-1, +1, -1);      //REAR_R
+            motor[1] = PIDMIX(-1, -1, +1);      //FRONT_R
+            motor[2] = PIDMIX(+1, +1, +1);      //REAR_L
+            motor[3] = PIDMIX(+1, -1, -1);      //FRONT_L
+            break;
+
+        case MULTITYPE_Y4:
+            motor[0] = PIDMIX(+0, +1, -1);      //REAR_1 CW
+            motor[1] = PIDMIX(-1, -1, 0);       //FRONT_R CCW
+            motor[2] = PIDMIX(+0, +1, +1);      //REAR_2 CCW
+            motor[3] = PIDMIX(+1, -1, 0);       //FRONT_L CW
+            break;
+
+        case MULTITYPE_Y6:
+            motor[0] = PIDMIX(+0, +4 / 3, +1);  //REAR
+            motor[1] = PIDMIX(-1, -2 / 3, -1);  //RIGHT
+            motor[2] = PIDMIX(+1, -2 / 3, -1);  //LEFT
+            motor[3] = PIDMIX(+0, +4 / 3, -1);  //UNDER_REAR
+            motor[4] = PIDMIX(-1, -2 / 3, +1);  //UNDER_RIGHT
+            motor[5] = PIDMIX(+1, -2 / 3, +1);  //UNDER_LEFT
+            break;
+
+        case MULTITYPE_HEX6:
+            motor[0] = PIDMIX(-1 / 2, +1 / 2, +1);      //REAR_R
+            motor[1] = PIDMIX(-1 / 2, -1 / 2, -1);      //FRONT_R
+            motor[2] = PIDMIX(+1 / 2, +1 / 2, +1);      //REAR_L
+            motor[3] = PIDMIX(+1 / 2, -1 / 2, -1);      //FRONT_L
+            motor[4] = PIDMIX(+0, -1, +1);      //FRONT
+            motor[5] = PIDMIX(+0, +1, -1);      //REAR
+            break;
+
+        case MULTITYPE_HEX6X:
+            motor[0] = PIDMIX(-1 / 2, +1 / 2, +1);      //REAR_R
+            motor[1] = PIDMIX(-1 / 2, -1 / 2, +1);      //FRONT_R
+            motor[2] = PIDMIX(+1 / 2, +1 / 2, -1);      //REAR_L
+            motor[3] = PIDMIX(+1 / 2, -1 / 2, -1);      //FRONT_L
+            motor[4] = PIDMIX(-1, +0, -1);      //RIGHT
+            motor[5] = PIDMIX(+1, +0, +1);      //LEFT
+            break;
+
+        case MULTITYPE_OCTOX8:
+            motor[0] = PIDMIX(-1, +1, -1);      //REAR_R
+            motor[1] = PIDMIX(-1, -1, +1);      //FRONT_R
+            motor[2] = PIDMIX(+1, +1, +1);      //REAR_L
+            motor[3] = PIDMIX(+1, -1, -1);      //FRONT_L
+            motor[4] = PIDMIX(-1, +1, +1);      //UNDER_REAR_R
+            motor[5] = PIDMIX(-1, -1, -1);      //UNDER_FRONT_R
+            motor[6] = PIDMIX(+1, +1, -1);      //UNDER_REAR_L
+            motor[7] = PIDMIX(+1, -1, +1);      //UNDER_FRONT_L
+            break;
+
+        case MULTITYPE_OCTOFLATP:
+            motor[0] = PIDMIX(+7 / 10, -7 / 10, +1);    //FRONT_L
+            motor[1] = PIDMIX(-7 / 10, -7 / 10, +1);    //FRONT_R
+            motor[2] = PIDMIX(-7 / 10, +7 / 10, +1);    //REAR_R
+            motor[3] = PIDMIX(+7 / 10, +7 / 10, +1);    //REAR_L
+            motor[4] = PIDMIX(+0, -1, -1);      //FRONT
+            motor[5] = PIDMIX(-1, +0, -1);      //RIGHT
+            motor[6] = PIDMIX(+0, +1, -1);      //REAR
+            motor[7] = PIDMIX(+1, +0, -1);      //LEFT
+            break;
+
+        case MULTITYPE_OCTOFLATX:
+            motor[0] = PIDMIX(+1, -1 / 2, +1);  //MIDFRONT_L
+            motor[1] = PIDMIX(-1 / 2, -1, +1);  //FRONT_R
+            motor[2] = PIDMIX(-1, +1 / 2, +1);  //MIDREAR_R
+            motor[3] = PIDMIX(+1 / 2, +1, +1);  //REAR_L
+            motor[4] = PIDMIX(+1 / 2, -1, -1);  //FRONT_L
+            motor[5] = PIDMIX(-1, -1 / 2, -1);  //MIDFRONT_R
+            motor[6] = PIDMIX(-1 / 2, +1, -1);  //REAR_R
+            motor[7] = PIDMIX(+1, +1 / 2, -1);  //MIDREAR_L
+            break;
+
+        case MULTITYPE_VTAIL4:
+            motor[0] = PIDMIX(+0, +1, -1 / 2);      //REAR_R
+            motor[1] = PIDMIX(-1, -1, +2 / 10); //FRONT_R
+            motor[2] = PIDMIX(+0, +1, +1 / 2);      //REAR_L
+            motor[3] = PIDMIX(+1, -1, -2 / 10); //FRONT_L
+            break;
+
+        case MULTITYPE_FLYING_WING:
+            motor[0] = rcCommand[THROTTLE];
+            break;
+    }
+}
+
+static void checkType(uint8_t type)
+{
+    int16_t thr, r, p, y;
+    uint8_t i;
+
+    cfg.mixerConfiguration = type;
+    mixerInit();
+
+    if (type == MULTITYPE_AIRPLANE || type == MULTITYPE_HELI_120_CCPM || type == MULTITYPE_HELI_90_DEG) {
+        // were never mixed, the old code only drove 4 motor outputs at their last value
+        if (numberMotor != 0) {
+            printf("type %d: %d motors, expected 0\n", type, numberMotor);
+            failures++;
+        }
+        return;
+    }
+    if (numberMotor != oldNumberMotor(type)) {
+        printf("type %d: %d motors, old code had %d\n", type, numberMotor, oldNumberMotor(type));
+        failures++;
+        return;
+    }
+
+    for (thr = 1200; thr <= 1800; thr += 300) {
+        for (r = -300; r <= 300; r += 20) {
+            for (p = -300; p <= 300; p += 20) {
+                for (y = -300; y <= 300; y += 20) {
+                    rcCommand[THROTTLE] = thr;
+                    axisPID[ROLL] = r;
+                    axisPID[PITCH] = p;
+                    axisPID[YAW] = y;
+                    // mixTable() applies the yaw jump limit to axisPID[YAW] in place, oldMix() sees the same value
+                    mixTable();
+                    oldMix();
+                    for (i = 0; i < numberMotor; i++) {
+                        int diff = abs(motor[i] - oldMotor[i]);
+                        checks++;
+                        if (diff > maxDiff)
+                            maxDiff = diff;
+                        if (diff > MIX_TOLERANCE) {
+                            if (failures < 20)
+                                printf("type %d dir %d motor %d thr %d pid %d/%d/%d: %d, old %d\n", type, cfg.yaw_direction, i, thr, r, p, y, motor[i], oldMotor[i]);
+                            failures++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    uint8_t type;
+
+    // keep the limiting loop in mixTable() out of the way
+    cfg.minthrottle = 0;
+    cfg.maxthrottle = 4000;
+    cfg.mincommand = 0;
+    cfg.mincheck = 1100;
+    cfg.midrc = 1500;
+    rcData[THROTTLE] = 1500;
+    rcCommand[YAW] = 0;
+
+    for (cfg.yaw_direction = -1; cfg.yaw_direction <= 1; cfg.yaw_direction += 2)
+        for (type = 1; type < MULTITYPE_CUSTOM; type++)
+            checkType(type);
+
+    printf("mixer: %u checks, max difference %d, %u failures\n", checks, maxDiff, failures);
+    return failures ? 1 : 0;
+}
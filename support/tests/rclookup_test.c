@@ -0,0 +1,198 @@
+/*
+    rclookup_test - host check of the RC lookup tables against the per-loop math they replaced
+
+    Builds the tables with generateLookupTables() from src/config.c for a spread of configs and
+    compares rcCommand and dynP8/dynD8 for every stick and throttle value with the pre-table code.
+*/
+
+#include "../../src/config.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int16_t lookupPitchRollRC[RC_LOOKUP_LENGTH];
+int16_t lookupThrottleRC[THROTTLE_LOOKUP_LENGTH];
+
+// config.c links against these, none of them is called here
+void FLASH_Unlock(void) { }
+void FLASH_Lock(void) { }
+void FLASH_ClearFlag(uint32_t flag) { (void)flag; }
+FLASH_Status FLASH_ErasePage(uint32_t address) { (void)address; return FLASH_COMPLETE; }
+FLASH_Status FLASH_ProgramWord(uint32_t address, uint32_t data) { (void)address; (void)data; return FLASH_COMPLETE; }
+void blinkLED(uint8_t num, uint8_t wait, uint8_t repeat) { (void)num; (void)wait; (void)repeat; }
+
+typedef struct {
+    int16_t rcCommand;
+    uint8_t dynP8, dynD8;
+} axisOut_t;
+
+static int16_t lookupRX[7];
+static uint32_t checks = 0, failures = 0;
+
+// annexCode() before the tables, verbatim apart from the outputs
+static void oldAxis(int16_t *rcData, uint8_t axis, axisOut_t *out)
+{
+    uint8_t prop1, prop2;
+    uint16_t tmp;
+
+    if (rcData[THROTTLE] < 1500) {
+        prop2 = 100;
+    } else if (rcData[THROTTLE] < 2000) {
+        prop2 = 100 - (uint16_t) cfg.dynThrPID * (rcData[THROTTLE] - 1500) / 500;
+    } else {
+        prop2 = 100 - cfg.dynThrPID;
+    }
+
+    tmp = min(abs(rcData[axis] - cfg.midrc), 500);
+    if (axis != 2) {        // ROLL & PITCH
+        uint16_t tmp2;
+        if (cfg.deadband) {
+            if (tmp > cfg.deadband) {
+                tmp -= cfg.deadband;
+            } else {
+                tmp = 0;
+            }
+        }
+        tmp2 = tmp / 100;
+        out->rcCommand = lookupRX[tmp2] + (tmp - tmp2 * 100) * (lookupRX[tmp2 + 1] - lookupRX[tmp2]) / 100;
+        prop1 = 100 - (uint16_t) cfg.rollPitchRate * tmp / 500;
+        prop1 = (uint16_t)prop1 * prop2 / 100;
+    } else {                // YAW
+        if (cfg.yawdeadband) {
+            if (tmp > cfg.yawdeadband) {
+                tmp -= cfg.yawdeadband;
+            } else {
+                tmp = 0;
+            }
+        }
+        out->rcCommand = tmp;
+        prop1 = 100 - (uint16_t)cfg.yawRate * tmp / 500;
+    }
+    out->dynP8 = (uint16_t)cfg.P8[axis] * prop1 / 100;
+    out->dynD8 = (uint16_t)cfg.D8[axis] * prop1 / 100;
+    if (rcData[axis] < cfg.midrc)
+        out->rcCommand = -out->rcCommand;
+}
+
+// annexCode() as it is now
+static void newAxis(int16_t *rcData, uint8_t axis, axisOut_t *out)
+{
+    uint8_t prop1, prop2;
+    uint16_t tmp;
+
+    if (rcData[THROTTLE] < 1500) {
+        prop2 = 100;
+    } else if (rcData[THROTTLE] < 2000) {
+        prop2 = 100 - (uint16_t) cfg.dynThrPID * (rcData[THROTTLE] - 1500) / 500;
+    } else {
+        prop2 = 100 - cfg.dynThrPID;
+    }
+
+    tmp = min(abs(rcData[axis] - cfg.midrc), 500);
+    if (axis != 2) {        // ROLL & PITCH
+        out->rcCommand = lookupPitchRollRC[tmp];
+        tmp = tmp > cfg.deadband ? tmp - cfg.deadband : 0;
+        prop1 = 100 - (uint16_t) cfg.rollPitchRate * tmp / 500;
+        prop1 = (uint16_t)prop1 * prop2 / 100;
+    } else {                // YAW
+        tmp = tmp > cfg.yawdeadband ? tmp - cfg.yawdeadband : 0;
+        out->rcCommand = tmp;
+        prop1 = 100 - (uint16_t)cfg.yawRate * tmp / 500;
+    }
+    out->dynP8 = (uint16_t)cfg.P8[axis] * prop1 / 100;
+    out->dynD8 = (uint16_t)cfg.D8[axis] * prop1 / 100;
+    if (rcData[axis] < cfg.midrc)
+        out->rcCommand = -out->rcCommand;
+}
+
+static void fail(const char *what, int stick, int throttle, int expected, int got)
+{
+    if (failures++ < 10)
+        printf("FAIL %s: stick %d throttle %d rate %d expo %d deadband %d/%d: expected %d, got %d\n", what, stick, throttle,
+            cfg.rcRate8, cfg.rcExpo8, cfg.deadband, cfg.yawdeadband, expected, got);
+}
+
+static void checkConfig(void)
+{
+    int16_t rcData[8];
+    axisOut_t o, n;
+    int stick, throttle, axis, i;
+
+    for (i = 0; i < 7; i++)
+        lookupRX[i] = (2500 + cfg.rcExpo8 * (i * i - 25)) * i * (int32_t) cfg.rcRate8 / 1250;
+    generateLookupTables();
+
+    // every stick value from beyond the low end to beyond the high end, against every throttle value
+    for (throttle = 1000; throttle <= 2000; throttle++) {
+        rcData[THROTTLE] = throttle;
+        for (stick = 900; stick <= 2100; stick++) {
+            for (axis = 0; axis < 3; axis++) {
+                rcData[axis] = stick;
+                oldAxis(rcData, axis, &o);
+                newAxis(rcData, axis, &n);
+                checks++;
+                if (o.rcCommand != n.rcCommand)
+                    fail("rcCommand", stick, throttle, o.rcCommand, n.rcCommand);
+                if (o.dynP8 != n.dynP8)
+                    fail("dynP8", stick, throttle, o.dynP8, n.dynP8);
+                if (o.dynD8 != n.dynD8)
+                    fail("dynD8", stick, throttle, o.dynD8, n.dynD8);
+            }
+        }
+
+        checks++;
+        i = cfg.minthrottle + (int32_t)(cfg.maxthrottle - cfg.minthrottle) * (throttle - cfg.mincheck) / (2000 - cfg.mincheck);
+        if (lookupThrottleRC[throttle - 1000] != i)
+            fail("throttle", 0, throttle, i, lookupThrottleRC[throttle - 1000]);
+    }
+}
+
+int main(void)
+{
+    static const uint8_t rates[] = { 0, 1, 20, 45, 90, 150, 255 };
+    static const uint8_t expos[] = { 0, 30, 65, 100 };
+    int configs = 0, i;
+
+    // firmware defaults first, checkFirstTime() can't run here since it reads flash
+    cfg.P8[ROLL] = 40;
+    cfg.D8[ROLL] = 23;
+    cfg.P8[PITCH] = 40;
+    cfg.D8[PITCH] = 23;
+    cfg.P8[YAW] = 85;
+    cfg.D8[YAW] = 0;
+    cfg.rcRate8 = 45;
+    cfg.rcExpo8 = 65;
+    cfg.midrc = 1500;
+    cfg.mincheck = 1100;
+    cfg.minthrottle = 1150;
+    cfg.maxthrottle = 1850;
+    checkConfig();
+    configs++;
+
+    srand(1);
+
+    for (i = 0; i < 48; i++) {
+        cfg.rcRate8 = rates[i % sizeof(rates)];
+        cfg.rcExpo8 = expos[i % sizeof(expos)];
+        cfg.deadband = rand() % 33;
+        cfg.yawdeadband = rand() % 101;
+        cfg.midrc = 1400 + rand() % 201;
+        cfg.rollPitchRate = rand() % 101;
+        cfg.yawRate = rand() % 101;
+        cfg.dynThrPID = rand() % 101;
+        cfg.P8[ROLL] = rand() % 201;
+        cfg.P8[PITCH] = rand() % 201;
+        cfg.P8[YAW] = rand() % 201;
+        cfg.D8[ROLL] = rand() % 201;
+        cfg.D8[PITCH] = rand() % 201;
+        cfg.D8[YAW] = rand() % 201;
+        cfg.mincheck = 900 + rand() % 400;
+        cfg.minthrottle = 1000 + rand() % 300;
+        cfg.maxthrottle = 1700 + rand() % 301;
+        checkConfig();
+        configs++;
+    }
+
+    printf("rclookup: %d configs, %u checks, %u failures\n", configs, checks, failures);
+    return failures ? 1 : 0;
+}